@@ -0,0 +1,182 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+#include "baseline.hpp"
+
+namespace mapnik_render
+{
+
+namespace
+{
+
+// Smallest p-value reachable with the given numbers of samples, the one of
+// samples which do not overlap at all.
+double min_p_value(std::size_t a, std::size_t b)
+{
+    std::vector<duration_type> first;
+    std::vector<duration_type> second;
+    for (std::size_t i = 0; i < a; i++)
+    {
+        first.emplace_back(i);
+    }
+    for (std::size_t i = 0; i < b; i++)
+    {
+        second.emplace_back(a + i);
+    }
+    return mann_whitney_p(first, second);
+}
+
+}
+
+baseline::baseline(boost::filesystem::path const & file,
+                   double significance,
+                   boost::optional<double> const & threshold)
+    : significance_(significance),
+      threshold_(threshold)
+{
+    boost::property_tree::ptree tree;
+    try
+    {
+        boost::property_tree::read_json(file.string(), tree);
+    }
+    catch (boost::property_tree::json_parser_error const & ex)
+    {
+        throw std::runtime_error("Cannot read baseline " + file.string() + ": " + ex.message());
+    }
+
+    boost::optional<boost::property_tree::ptree &> results(tree.get_child_optional("results"));
+    if (!results)
+    {
+        throw std::runtime_error("Baseline " + file.string() + " is not a JSON report");
+    }
+
+    for (auto const & item : *results)
+    {
+        boost::property_tree::ptree const & r = item.second;
+        if (r.get<std::string>("state", "") == "error" || r.get<bool>("cached", false))
+        {
+            continue;
+        }
+
+        std::vector<duration_type> samples;
+        if (boost::optional<boost::property_tree::ptree const &> values = r.get_child_optional("samples_ns"))
+        {
+            for (auto const & value : *values)
+            {
+                samples.emplace_back(std::chrono::duration_cast<duration_type>(
+                    std::chrono::nanoseconds(value.second.get_value<std::int64_t>())));
+            }
+        }
+
+        if (!samples.empty())
+        {
+            samples_[configuration(r.get<std::string>("image_path", ""))] = std::move(samples);
+        }
+    }
+}
+
+baseline_comparison baseline::compare(result_list const & results) const
+{
+    baseline_comparison comparison;
+    comparison.significance = significance_;
+    for (std::size_t n = 1; n <= 1000; n++)
+    {
+        if (decidable(n, n))
+        {
+            comparison.samples_needed = n;
+            break;
+        }
+    }
+
+    for (auto const & r : results)
+    {
+        if (r.state == STATE_ERROR || r.cached || r.samples.empty())
+        {
+            continue;
+        }
+
+        auto it = samples_.find(configuration(r.image_path));
+        if (it == samples_.end())
+        {
+            comparison.unmatched++;
+            continue;
+        }
+        comparison.matched++;
+
+        if (!decidable(it->second.size(), r.samples.size()))
+        {
+            comparison.inconclusive++;
+            continue;
+        }
+
+        baseline_change change;
+        change.name = r.name;
+        change.renderer_name = r.renderer_name;
+        change.configuration = it->first;
+        change.baseline_median = compute_statistics(it->second).median;
+        change.median = r.statistics.median;
+        change.p_value = mann_whitney_p(it->second, r.samples);
+
+        if (change.p_value >= significance_ || change.median == change.baseline_median)
+        {
+            continue;
+        }
+
+        if (change.median > change.baseline_median)
+        {
+            double increase = 100.0 * (change.median - change.baseline_median).count() /
+                std::max<duration_type::rep>(change.baseline_median.count(), 1);
+            change.regression = threshold_ && increase > *threshold_;
+            if (change.regression)
+            {
+                comparison.regressions++;
+            }
+            comparison.slower.push_back(std::move(change));
+        }
+        else
+        {
+            comparison.faster.push_back(std::move(change));
+        }
+    }
+
+    return comparison;
+}
+
+bool baseline::decidable(std::size_t a, std::size_t b) const
+{
+    return min_p_value(a, b) < significance_;
+}
+
+std::string baseline::configuration(boost::filesystem::path const & image_path)
+{
+    // Output directory may differ between runs.
+    return image_path.filename().string();
+}
+
+}
@@ -0,0 +1,94 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#ifndef MAPNIK_RENDER_BASELINE_HPP
+#define MAPNIK_RENDER_BASELINE_HPP
+
+#include <string>
+#include <map>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/optional.hpp>
+
+#include "config.hpp"
+
+namespace mapnik_render
+{
+
+// Configuration whose duration differs significantly from the baseline.
+struct baseline_change
+{
+    std::string name;
+    std::string renderer_name;
+    // Image file name, it identifies style, size, scale, tiles, renderer and envelope.
+    std::string configuration;
+    duration_type baseline_median = duration_type::zero();
+    duration_type median = duration_type::zero();
+    double p_value = 1.0;
+    // Slower than baseline by more than regression threshold.
+    bool regression = false;
+};
+
+struct baseline_comparison
+{
+    std::vector<baseline_change> slower;
+    std::vector<baseline_change> faster;
+    std::size_t matched = 0;
+    std::size_t unmatched = 0;
+    // Matched configurations with too few samples on either side to reach
+    // significance whatever their durations, they can be neither slower
+    // nor faster.
+    std::size_t inconclusive = 0;
+    // Samples on each side needed to reach significance, 0 if unknown.
+    std::size_t samples_needed = 0;
+    double significance = 0;
+    unsigned regressions = 0;
+};
+
+// Per-iteration samples of a previous run read from its JSON report.
+class baseline
+{
+public:
+    // Changes with p-value below significance are listed, slower ones whose
+    // median grew by more than threshold percent count as regressions.
+    baseline(boost::filesystem::path const & file,
+             double significance,
+             boost::optional<double> const & threshold);
+
+    baseline_comparison compare(result_list const & results) const;
+
+private:
+    static std::string configuration(boost::filesystem::path const & image_path);
+
+    // Whether samples of these sizes can be significantly different at all.
+    bool decidable(std::size_t a, std::size_t b) const;
+
+    std::map<std::string, std::vector<duration_type>> samples_;
+    const double significance_;
+    const boost::optional<double> threshold_;
+};
+
+}
+
+#endif
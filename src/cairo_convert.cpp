@@ -0,0 +1,60 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#include "cairo_convert.hpp"
+
+namespace mapnik_render
+{
+
+void cairo_argb_to_rgba(std::uint32_t * pixels, std::size_t count)
+{
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        std::uint32_t in = pixels[i];
+        std::uint32_t a = in >> 24;
+
+        if (a == 0xff)
+        {
+            pixels[i] = (in & 0xff00ff00) | ((in >> 16) & 0xff) | ((in & 0xff) << 16);
+            continue;
+        }
+        if (a == 0)
+        {
+            pixels[i] = 0;
+            continue;
+        }
+
+        std::uint32_t r = (in >> 16) & 0xff;
+        std::uint32_t g = (in >> 8) & 0xff;
+        std::uint32_t b = in & 0xff;
+        r = r * 255 / a;
+        g = g * 255 / a;
+        b = b * 255 / a;
+        if (r > 255) r = 255;
+        if (g > 255) g = 255;
+        if (b > 255) b = 255;
+        pixels[i] = (a << 24) | (b << 16) | (g << 8) | r;
+    }
+}
+
+}
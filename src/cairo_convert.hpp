@@ -0,0 +1,40 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#ifndef MAPNIK_RENDER_CAIRO_CONVERT_HPP
+#define MAPNIK_RENDER_CAIRO_CONVERT_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mapnik_render
+{
+
+// Converts premultiplied cairo ARGB32 pixels to demultiplied RGBA pixels of
+// mapnik::image_rgba8 in place, with the same rounding as
+// mapnik::cairo_image_to_rgba8. Opaque pixels only swap red and blue.
+void cairo_argb_to_rgba(std::uint32_t * pixels, std::size_t count);
+
+}
+
+#endif
@@ -0,0 +1,152 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MAPNIK_RENDER_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#include "compare.hpp"
+
+namespace mapnik_render
+{
+
+namespace
+{
+
+using compare_function = std::size_t (*)(std::uint32_t const *, std::uint32_t const *, std::size_t, unsigned);
+
+std::size_t compare_scalar(std::uint32_t const * actual,
+                           std::uint32_t const * expected,
+                           std::size_t count,
+                           unsigned tolerance)
+{
+    std::size_t different = 0;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        std::uint32_t a = actual[i];
+        std::uint32_t e = expected[i];
+        if (a == e)
+        {
+            continue;
+        }
+        for (unsigned shift = 0; shift < 32; shift += 8)
+        {
+            int diff = static_cast<int>((a >> shift) & 0xff) - static_cast<int>((e >> shift) & 0xff);
+            if (static_cast<unsigned>(std::abs(diff)) > tolerance)
+            {
+                different++;
+                break;
+            }
+        }
+    }
+    return different;
+}
+
+#if defined(MAPNIK_RENDER_X86_SIMD)
+
+// Per channel absolute difference is max(a - e, e - a) with unsigned saturation,
+// subtracting tolerance with saturation leaves non-zero bytes only where
+// the difference exceeds it. A pixel differs if its 32 bits are not zero.
+
+__attribute__((target("sse2")))
+std::size_t compare_sse2(std::uint32_t const * actual,
+                         std::uint32_t const * expected,
+                         std::size_t count,
+                         unsigned tolerance)
+{
+    const __m128i threshold = _mm_set1_epi8(static_cast<char>(tolerance));
+    const __m128i zero = _mm_setzero_si128();
+    std::size_t different = 0;
+    std::size_t i = 0;
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i const *>(actual + i));
+        __m128i e = _mm_loadu_si128(reinterpret_cast<__m128i const *>(expected + i));
+        __m128i diff = _mm_or_si128(_mm_subs_epu8(a, e), _mm_subs_epu8(e, a));
+        __m128i over = _mm_subs_epu8(diff, threshold);
+        int same = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(over, zero)));
+        different += 4 - __builtin_popcount(same);
+    }
+
+    return different + compare_scalar(actual + i, expected + i, count - i, tolerance);
+}
+
+__attribute__((target("avx2")))
+std::size_t compare_avx2(std::uint32_t const * actual,
+                         std::uint32_t const * expected,
+                         std::size_t count,
+                         unsigned tolerance)
+{
+    const __m256i threshold = _mm256_set1_epi8(static_cast<char>(tolerance));
+    const __m256i zero = _mm256_setzero_si256();
+    std::size_t different = 0;
+    std::size_t i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(actual + i));
+        __m256i e = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(expected + i));
+        __m256i diff = _mm256_or_si256(_mm256_subs_epu8(a, e), _mm256_subs_epu8(e, a));
+        __m256i over = _mm256_subs_epu8(diff, threshold);
+        int same = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(over, zero)));
+        different += 8 - __builtin_popcount(same);
+    }
+
+    return different + compare_sse2(actual + i, expected + i, count - i, tolerance);
+}
+
+#endif
+
+compare_function select_compare()
+{
+#if defined(MAPNIK_RENDER_X86_SIMD)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return compare_avx2;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        return compare_sse2;
+    }
+#endif
+    return compare_scalar;
+}
+
+}
+
+std::size_t compare_pixels(std::uint32_t const * actual,
+                           std::uint32_t const * expected,
+                           std::size_t count,
+                           unsigned tolerance)
+{
+    static const compare_function compare = select_compare();
+    return compare(actual, expected, count, std::min(tolerance, 255u));
+}
+
+}
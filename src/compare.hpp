@@ -0,0 +1,42 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#ifndef MAPNIK_RENDER_COMPARE_HPP
+#define MAPNIK_RENDER_COMPARE_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mapnik_render
+{
+
+// Counts pixels where any channel differs by more than tolerance. Uses
+// AVX2 or SSE2 when available on the running CPU, scalar code otherwise.
+std::size_t compare_pixels(std::uint32_t const * actual,
+                           std::uint32_t const * expected,
+                           std::size_t count,
+                           unsigned tolerance);
+
+}
+
+#endif
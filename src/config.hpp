@@ -26,10 +26,14 @@
 #include <vector>
 #include <string>
 #include <chrono>
+#include <cstdint>
 
 #include <mapnik/box2d.hpp>
 
 #include <boost/filesystem.hpp>
+#include <boost/optional.hpp>
+
+#include "statistics.hpp"
 
 namespace mapnik_render
 {
@@ -50,12 +54,96 @@ struct config
     std::vector<mapnik::box2d<double>> envelopes;
 };
 
+struct iteration_config
+{
+    // Minimal number of measured iterations.
+    std::size_t iterations = 1;
+    // Iterations rendered before measurement starts.
+    std::size_t warmup = 0;
+    // Keep iterating until measured time reaches min_time ...
+    std::chrono::high_resolution_clock::duration min_time = std::chrono::high_resolution_clock::duration::zero();
+    // ... and until coefficient of variation of samples drops below max_cv,
+    // unless measured time exceeds max_time. Zero disables the check.
+    double max_cv = 0;
+    std::chrono::high_resolution_clock::duration max_time = std::chrono::seconds(10);
+    // Count heap allocations of the last measured iteration.
+    bool memory = false;
+    // Read hardware and CPU time counters around measured iterations.
+    bool cpu = false;
+};
+
 enum result_state : std::uint8_t
 {
     STATE_OK,
+    STATE_FAIL,
     STATE_ERROR
 };
 
+// Wall time spent in individual phases of producing one result.
+struct phase_durations
+{
+    duration_type load_map = duration_type::zero();
+    duration_type zoom = duration_type::zero();
+    duration_type render = duration_type::zero();
+    duration_type encode = duration_type::zero();
+    duration_type write = duration_type::zero();
+};
+
+// Heap usage of one render and resident set size of the process after it.
+struct memory_usage
+{
+    std::uint64_t allocations = 0;
+    std::uint64_t bytes = 0;
+    std::uint64_t peak_heap = 0;
+    std::uint64_t rss = 0;
+    std::uint64_t peak_rss = 0;
+};
+
+// CPU usage of the rendering thread, mean of measured iterations. Hardware
+// events are missing where perf events are not available.
+struct cpu_usage
+{
+    boost::optional<std::uint64_t> cycles;
+    boost::optional<std::uint64_t> instructions;
+    boost::optional<std::uint64_t> cache_misses;
+    boost::optional<std::uint64_t> branch_misses;
+    duration_type cpu_time = duration_type::zero();
+    duration_type user_time = duration_type::zero();
+    duration_type system_time = duration_type::zero();
+    std::uint64_t voluntary_switches = 0;
+    std::uint64_t involuntary_switches = 0;
+};
+
+// Counters of image buffers reused from pool and newly allocated.
+struct image_pool_usage
+{
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+};
+
+// Serial render of a job compared to its render with mapnik::parallelizer,
+// durations are medians of the same number of iterations.
+struct parallelizer_comparison
+{
+    duration_type serial = duration_type::zero();
+    duration_type parallel = duration_type::zero();
+    std::size_t threads = 0;
+    double speedup = 0;
+    // Speedup per thread, 1 for perfect scaling.
+    double efficiency = 0;
+    std::size_t mismatched_pixels = 0;
+};
+
+// Tiles of a job rendered one by one compared to their concurrent render on
+// tile pool, durations are medians of the same number of iterations.
+struct tile_comparison
+{
+    duration_type serial = duration_type::zero();
+    duration_type concurrent = duration_type::zero();
+    std::size_t threads = 0;
+    double speedup = 0;
+};
+
 struct result
 {
     std::string name;
@@ -64,13 +152,54 @@ struct result
     map_size size;
     map_size tiles;
     double scale_factor;
+    // Envelope the job zoomed to, none when the whole map was rendered.
+    boost::optional<mapnik::box2d<double>> envelope;
     boost::filesystem::path image_path;
     std::string error_message;
     std::chrono::high_resolution_clock::duration duration;
+    // Duration of every iteration, duration above is their sum.
+    std::vector<duration_type> samples;
+    duration_statistics statistics;
+    // Sum of render times of individual tiles. Divided by duration it gives
+    // the average number of tiles rendered at once.
+    std::chrono::high_resolution_clock::duration tiles_duration;
+    phase_durations phases;
+    // Hash of raw image data, set by checksum sink.
+    boost::optional<std::uint64_t> checksum;
+    // Number of pixels differing from reference image, set in comparison mode.
+    boost::optional<std::size_t> mismatched_pixels;
+    // Key in render cache and whether the result was taken from it.
+    boost::optional<std::uint64_t> cache_key;
+    bool cached = false;
+    // Set in memory instrumentation mode.
+    boost::optional<memory_usage> memory;
+    // Set in CPU counters mode.
+    boost::optional<cpu_usage> cpu;
+    // Set in parallelizer comparison mode for parallelizable maps.
+    boost::optional<parallelizer_comparison> parallelizer;
+    // Set in tile comparison mode for tiled jobs rendered on tile pool.
+    boost::optional<tile_comparison> tile_pool;
 };
 
 using result_list = std::vector<result>;
 
+// One cell of style × size × scale × tiles × renderer × envelope matrix.
+struct job
+{
+    boost::filesystem::path style_path;
+    std::string name;
+    map_size size;
+    double scale_factor;
+    map_size tiles;
+    std::size_t renderer_index;
+    boost::optional<mapnik::box2d<double>> envelope;
+    // Hash of style and its files, set when render cache is used.
+    std::uint64_t style_hash = 0;
+    // Time the style took to load while its jobs were created, accounted
+    // to its first job.
+    duration_type load_map = duration_type::zero();
+};
+
 }
 
 #endif
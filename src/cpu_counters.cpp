@@ -0,0 +1,185 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#include <cstring>
+#include <initializer_list>
+
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <linux/perf_event.h>
+
+#include "cpu_counters.hpp"
+
+namespace mapnik_render
+{
+
+constexpr const std::size_t cpu_counters::event_count;
+
+namespace
+{
+
+const std::uint64_t events[] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    // Last level cache misses on most CPUs.
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES
+};
+
+int open_event(std::uint64_t config)
+{
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(::syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+duration_type to_duration(timeval const & time)
+{
+    return std::chrono::duration_cast<duration_type>(
+        std::chrono::seconds(time.tv_sec) + std::chrono::microseconds(time.tv_usec));
+}
+
+std::uint64_t delta(std::uint64_t end, std::uint64_t start)
+{
+    return end > start ? end - start : 0;
+}
+
+}
+
+cpu_counters::cpu_counters()
+{
+    for (std::size_t i = 0; i < event_count; i++)
+    {
+        fds_[i] = open_event(events[i]);
+    }
+    start_ = read();
+}
+
+cpu_counters::~cpu_counters()
+{
+    for (int fd : fds_)
+    {
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+    }
+}
+
+void cpu_counters::start()
+{
+    start_ = read();
+}
+
+void cpu_counters::stop(cpu_usage & total) const
+{
+    snapshot end(read());
+    boost::optional<std::uint64_t> cpu_usage::* const fields[] = {
+        &cpu_usage::cycles,
+        &cpu_usage::instructions,
+        &cpu_usage::cache_misses,
+        &cpu_usage::branch_misses
+    };
+    for (std::size_t i = 0; i < event_count; i++)
+    {
+        if (start_.valid[i] && end.valid[i])
+        {
+            // Event multiplexed with others is scaled from the time it was
+            // counting to the whole time it was enabled within the interval.
+            std::uint64_t value = delta(end.events[i][0], start_.events[i][0]);
+            std::uint64_t enabled = delta(end.events[i][1], start_.events[i][1]);
+            std::uint64_t running = delta(end.events[i][2], start_.events[i][2]);
+            if (running > 0 && running < enabled)
+            {
+                value = static_cast<std::uint64_t>(static_cast<double>(value) * enabled / running);
+            }
+            boost::optional<std::uint64_t> & field = total.*fields[i];
+            field = field.value_or(0) + value;
+        }
+    }
+    total.cpu_time += end.cpu_time - start_.cpu_time;
+    total.user_time += end.user_time - start_.user_time;
+    total.system_time += end.system_time - start_.system_time;
+    total.voluntary_switches += delta(end.voluntary_switches, start_.voluntary_switches);
+    total.involuntary_switches += delta(end.involuntary_switches, start_.involuntary_switches);
+}
+
+cpu_usage cpu_counters::mean(cpu_usage const & total, std::size_t count)
+{
+    cpu_usage usage(total);
+    if (count > 1)
+    {
+        for (boost::optional<std::uint64_t> * field : { &usage.cycles, &usage.instructions,
+                                                        &usage.cache_misses, &usage.branch_misses })
+        {
+            if (*field)
+            {
+                **field /= count;
+            }
+        }
+        usage.cpu_time /= count;
+        usage.user_time /= count;
+        usage.system_time /= count;
+        usage.voluntary_switches /= count;
+        usage.involuntary_switches /= count;
+    }
+    return usage;
+}
+
+cpu_counters::snapshot cpu_counters::read() const
+{
+    snapshot s;
+
+    for (std::size_t i = 0; i < event_count; i++)
+    {
+        s.valid[i] = fds_[i] >= 0 && ::read(fds_[i], s.events[i], sizeof(s.events[i])) == sizeof(s.events[i]);
+    }
+
+    timespec cpu;
+    s.cpu_time = duration_type::zero();
+    if (::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu) == 0)
+    {
+        s.cpu_time = std::chrono::duration_cast<duration_type>(
+            std::chrono::seconds(cpu.tv_sec) + std::chrono::nanoseconds(cpu.tv_nsec));
+    }
+
+    rusage usage;
+    std::memset(&usage, 0, sizeof(usage));
+    ::getrusage(RUSAGE_THREAD, &usage);
+    s.user_time = to_duration(usage.ru_utime);
+    s.system_time = to_duration(usage.ru_stime);
+    s.voluntary_switches = usage.ru_nvcsw;
+    s.involuntary_switches = usage.ru_nivcsw;
+
+    return s;
+}
+
+}
@@ -0,0 +1,78 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#ifndef MAPNIK_RENDER_CPU_COUNTERS_HPP
+#define MAPNIK_RENDER_CPU_COUNTERS_HPP
+
+#include <cstdint>
+
+#include "config.hpp"
+
+namespace mapnik_render
+{
+
+// Hardware events, CPU time and context switches of the calling thread.
+// Events are counted in user space through perf_event_open and left out when
+// the kernel does not allow it, e.g. in containers or with restrictive
+// perf_event_paranoid. Work done on other threads, such as tiles rendered on
+// tile pool, is not included.
+class cpu_counters
+{
+public:
+    cpu_counters();
+    ~cpu_counters();
+
+    cpu_counters(cpu_counters const &) = delete;
+    cpu_counters & operator=(cpu_counters const &) = delete;
+
+    void start();
+    // Adds usage since start to total.
+    void stop(cpu_usage & total) const;
+
+    // Usage of one of count iterations.
+    static cpu_usage mean(cpu_usage const & total, std::size_t count);
+
+private:
+    static constexpr const std::size_t event_count = 4;
+
+    struct snapshot
+    {
+        // Raw value, time enabled and time running of every event.
+        std::uint64_t events[event_count][3];
+        bool valid[event_count];
+        duration_type cpu_time;
+        duration_type user_time;
+        duration_type system_time;
+        std::uint64_t voluntary_switches;
+        std::uint64_t involuntary_switches;
+    };
+
+    snapshot read() const;
+
+    int fds_[event_count];
+    snapshot start_;
+};
+
+}
+
+#endif
@@ -0,0 +1,409 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <functional>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <mapnik/load_map.hpp>
+
+#include "daemon.hpp"
+#include "thread_pool.hpp"
+
+namespace mapnik_render
+{
+
+namespace
+{
+
+class daemon_visitor
+{
+public:
+    daemon_visitor(std::string const & name,
+                   mapnik::Map & map,
+                   daemon_request const & request,
+                   path_locks & paths,
+                   memory_sink const & replies,
+                   std::string & body)
+        : name_(name),
+          map_(map),
+          request_(request),
+          paths_(paths),
+          replies_(replies),
+          body_(body)
+    {
+    }
+
+    template <typename T>
+    std::string operator()(T const & renderer) const
+    {
+        typename T::image_type image(renderer.render(map_, request_.scale_factor));
+
+        result r(renderer.report(name_, request_.size, map_size(1, 1),
+                                 request_.scale_factor, map_.get_current_extent()));
+        boost::optional<std::string> data;
+        {
+            std::lock_guard<std::mutex> lock(paths_.get(r.image_path));
+            renderer.save(std::move(image), r);
+            if (request_.inline_output)
+            {
+                data = replies_.take(r.image_path);
+            }
+        }
+        if (r.state == STATE_ERROR)
+        {
+            throw std::runtime_error(r.error_message);
+        }
+
+        if (request_.inline_output)
+        {
+            if (!data)
+            {
+                throw std::runtime_error("No image data.");
+            }
+            body_ += *data;
+            return "DATA " + std::to_string(data->size());
+        }
+        return "OK " + r.image_path.string();
+    }
+
+private:
+    std::string const & name_;
+    mapnik::Map & map_;
+    daemon_request const & request_;
+    path_locks & paths_;
+    memory_sink const & replies_;
+    std::string & body_;
+};
+
+struct renderer_name_visitor
+{
+    template <typename T>
+    std::string operator()(T const &) const
+    {
+        return T::renderer_type::name;
+    }
+};
+
+bool send_all(int fd, char const * data, std::size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t sent = ::send(fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+}
+
+std::shared_ptr<mapnik::Map const> map_cache::get(boost::filesystem::path const & style_path)
+{
+    std::time_t mtime = boost::filesystem::last_write_time(style_path);
+    std::string key(boost::filesystem::absolute(style_path).string());
+
+    std::promise<std::shared_ptr<mapnik::Map const>> promise;
+    map_future future;
+    bool load = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = maps_.find(key);
+        if (it != maps_.end() && it->second.mtime == mtime)
+        {
+            // Loaded or being loaded by another request.
+            future = it->second.map;
+        }
+        else
+        {
+            future = promise.get_future().share();
+            entry & e = maps_[key];
+            e.mtime = mtime;
+            e.map = future;
+            load = true;
+        }
+    }
+
+    if (load)
+    {
+        try
+        {
+            std::shared_ptr<mapnik::Map> map(std::make_shared<mapnik::Map>());
+            mapnik::load_map(*map, style_path.string(), true);
+            promise.set_value(map);
+        }
+        catch (...)
+        {
+            promise.set_exception(std::current_exception());
+            // Let the next request try again.
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = maps_.find(key);
+            if (it != maps_.end() && it->second.mtime == mtime)
+            {
+                maps_.erase(it);
+            }
+        }
+    }
+    return future.get();
+}
+
+std::mutex & path_locks::get(boost::filesystem::path const & path)
+{
+    return mutexes_[std::hash<std::string>()(path.string()) % mutexes_.size()];
+}
+
+daemon_request daemon_request::parse(std::string const & line)
+{
+    daemon_request request;
+    std::istringstream tokens(line);
+    std::string token;
+
+    while (tokens >> token)
+    {
+        std::size_t equals = token.find('=');
+        if (equals == std::string::npos)
+        {
+            throw std::runtime_error("Expected key=value: " + token);
+        }
+        std::string key(token.substr(0, equals));
+        std::string value(token.substr(equals + 1));
+
+        if (key == "style")
+        {
+            request.style_path = value;
+        }
+        else if (key == "size")
+        {
+            std::size_t x = value.find('x');
+            if (x == std::string::npos)
+            {
+                throw std::runtime_error("Expected size as WIDTHxHEIGHT: " + value);
+            }
+            request.size = map_size(std::stoul(value.substr(0, x)), std::stoul(value.substr(x + 1)));
+        }
+        else if (key == "scale")
+        {
+            request.scale_factor = std::stod(value);
+        }
+        else if (key == "envelope")
+        {
+            mapnik::box2d<double> box;
+            if (!box.from_string(value))
+            {
+                throw std::runtime_error("Invalid envelope: " + value);
+            }
+            request.envelope = box;
+        }
+        else if (key == "renderer")
+        {
+            request.renderer_name = value;
+        }
+        else if (key == "output")
+        {
+            if (value != "inline" && value != "file")
+            {
+                throw std::runtime_error("Unknown output: " + value);
+            }
+            request.inline_output = value == "inline";
+        }
+        else
+        {
+            throw std::runtime_error("Unknown key: " + key);
+        }
+    }
+
+    if (request.style_path.empty())
+    {
+        throw std::runtime_error("No style given.");
+    }
+    if (!request.size.width || !request.size.height || request.scale_factor <= 0)
+    {
+        throw std::runtime_error("Empty image requested.");
+    }
+
+    return request;
+}
+
+render_daemon::render_daemon(renderer_container const & renderers,
+                             renderer_container const & inline_renderers,
+                             memory_sink const & replies,
+                             std::size_t jobs)
+    : renderers_(renderers),
+      inline_renderers_(inline_renderers),
+      replies_(replies),
+      jobs_(std::max<std::size_t>(jobs, 1))
+{
+}
+
+std::string render_daemon::handle(std::string const & line, std::string & body)
+{
+    try
+    {
+        daemon_request request(daemon_request::parse(line));
+
+        auto ren = std::find_if(renderers_.begin(), renderers_.end(), [&request](renderer_type const & r)
+        {
+            return request.renderer_name.empty() ||
+                mapnik::util::apply_visitor(renderer_name_visitor(), r) == request.renderer_name;
+        });
+        if (ren == renderers_.end())
+        {
+            throw std::runtime_error("Renderer not enabled: " + request.renderer_name);
+        }
+
+        // The cached map stays untouched, every request sizes and zooms a copy.
+        mapnik::Map map(*maps_.get(request.style_path));
+        map.resize(request.size.width * request.scale_factor, request.size.height * request.scale_factor);
+        if (request.envelope)
+        {
+            map.zoom_to_box(*request.envelope);
+        }
+        else
+        {
+            map.zoom_all();
+        }
+
+        daemon_visitor visitor(request.style_path.stem().string(), map, request, paths_, replies_, body);
+        renderer_type const & selected(request.inline_output ?
+            inline_renderers_[ren - renderers_.begin()] : *ren);
+        return mapnik::util::apply_visitor(visitor, selected);
+    }
+    catch (std::exception const & ex)
+    {
+        std::string message(ex.what());
+        std::replace(message.begin(), message.end(), '\n', ' ');
+        return "ERROR " + message;
+    }
+}
+
+void render_daemon::serve(std::istream & input, std::ostream & output)
+{
+    std::string line;
+    while (std::getline(input, line))
+    {
+        std::string body;
+        std::string header(handle(line, body));
+        output << header << '\n';
+        output.write(body.data(), body.size());
+        output.flush();
+    }
+}
+
+void render_daemon::serve(boost::filesystem::path const & socket_path)
+{
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.string().size() >= sizeof(address.sun_path))
+    {
+        throw std::runtime_error("Socket path is too long: " + socket_path.string());
+    }
+    std::strcpy(address.sun_path, socket_path.string().c_str());
+
+    int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0)
+    {
+        throw std::runtime_error(std::string("Cannot create socket: ") + std::strerror(errno));
+    }
+    ::unlink(address.sun_path);
+    if (::bind(listener, reinterpret_cast<sockaddr const *>(&address), sizeof(address)) < 0 ||
+        ::listen(listener, 16) < 0)
+    {
+        std::string error(std::strerror(errno));
+        ::close(listener);
+        throw std::runtime_error("Cannot listen on " + socket_path.string() + ": " + error);
+    }
+
+    thread_pool pool(jobs_);
+    while (true)
+    {
+        int fd = ::accept(listener, nullptr, nullptr);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            std::string error(std::strerror(errno));
+            ::close(listener);
+            throw std::runtime_error("Cannot accept connection: " + error);
+        }
+
+        pool.submit([this, fd](std::size_t)
+        {
+            serve_connection(fd);
+            ::close(fd);
+        });
+    }
+}
+
+void render_daemon::serve_connection(int fd)
+{
+    std::string pending;
+    char buffer[4096];
+
+    while (true)
+    {
+        ssize_t received = ::recv(fd, buffer, sizeof(buffer), 0);
+        if (received < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (received <= 0)
+        {
+            return;
+        }
+        pending.append(buffer, received);
+
+        std::size_t newline;
+        while ((newline = pending.find('\n')) != std::string::npos)
+        {
+            std::string body;
+            std::string response(handle(pending.substr(0, newline), body));
+            pending.erase(0, newline + 1);
+            response += '\n';
+            response += body;
+            if (!send_all(fd, response.data(), response.size()))
+            {
+                return;
+            }
+        }
+    }
+}
+
+}
@@ -0,0 +1,132 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#ifndef MAPNIK_RENDER_DAEMON_HPP
+#define MAPNIK_RENDER_DAEMON_HPP
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <future>
+#include <memory>
+#include <array>
+#include <iostream>
+#include <ctime>
+
+#include <mapnik/map.hpp>
+
+#include <boost/filesystem.hpp>
+#include <boost/optional.hpp>
+
+#include "config.hpp"
+#include "renderer.hpp"
+
+namespace mapnik_render
+{
+
+// Loaded maps keyed by style path, a style is loaded again when its
+// modification time changes. Styles are loaded outside of the lock, requests
+// for a style being loaded wait for that load only.
+class map_cache
+{
+public:
+    std::shared_ptr<mapnik::Map const> get(boost::filesystem::path const & style_path);
+
+private:
+    using map_future = std::shared_future<std::shared_ptr<mapnik::Map const>>;
+
+    struct entry
+    {
+        std::time_t mtime;
+        map_future map;
+    };
+
+    std::mutex mutex_;
+    std::map<std::string, entry> maps_;
+};
+
+// Serializes writes of concurrent requests saving to the same image path.
+class path_locks
+{
+public:
+    std::mutex & get(boost::filesystem::path const & path);
+
+private:
+    std::array<std::mutex, 64> mutexes_;
+};
+
+// One line of daemon protocol: whitespace separated key=value pairs, e.g.
+// "style=world.xml size=800x600 scale=2 envelope=-20,-20,20,20 renderer=agg output=inline".
+struct daemon_request
+{
+    boost::filesystem::path style_path;
+    map_size size { 512, 512 };
+    double scale_factor = 1.0;
+    boost::optional<mapnik::box2d<double>> envelope;
+    std::string renderer_name;
+    // Send encoded image back instead of saving it to output directory.
+    bool inline_output = false;
+
+    static daemon_request parse(std::string const & line);
+};
+
+// Serves render requests with fonts, plugins and styles loaded once.
+// Every request is answered by one line, "OK <path>" for a saved image,
+// "DATA <length>" followed by length bytes of an inline image or
+// "ERROR <message>".
+class render_daemon
+{
+public:
+    using renderer_container = std::vector<renderer_type>;
+
+    // Renderers of both containers are created from the same options, except
+    // for the sink: files for the former, replies for the latter.
+    render_daemon(renderer_container const & renderers,
+                  renderer_container const & inline_renderers,
+                  memory_sink const & replies,
+                  std::size_t jobs);
+
+    // Answers requests read from input line by line until end of file.
+    void serve(std::istream & input, std::ostream & output);
+
+    // Accepts clients on Unix socket, every connection is served on one of
+    // jobs workers until the client disconnects. Never returns normally.
+    void serve(boost::filesystem::path const & socket_path);
+
+    // Returns response line without newline, appends inline image to body.
+    std::string handle(std::string const & line, std::string & body);
+
+private:
+    void serve_connection(int fd);
+
+    const renderer_container renderers_;
+    const renderer_container inline_renderers_;
+    const memory_sink replies_;
+    const std::size_t jobs_;
+    map_cache maps_;
+    path_locks paths_;
+};
+
+}
+
+#endif
@@ -0,0 +1,265 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#include <stdexcept>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MAPNIK_RENDER_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#include "grid_convert.hpp"
+
+namespace mapnik_render
+{
+
+namespace
+{
+
+template <typename Id>
+using convert_function = void (*)(Id const *, std::uint32_t *, std::size_t, Id);
+
+// Highest id whose color id * 100 fits in 24 bits.
+const std::int32_t max_id = 0x00ffffff / 100;
+
+template <typename Id>
+void convert_scalar(Id const * ids,
+                    std::uint32_t * pixels,
+                    std::size_t count,
+                    Id base_mask)
+{
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        Id val = ids[i];
+
+        if (val == base_mask)
+        {
+            pixels[i] = 0;
+            continue;
+        }
+        if (val < 0)
+        {
+            throw std::runtime_error("grid renderer: feature id is negative.");
+        }
+        if (val > max_id)
+        {
+            throw std::runtime_error("grid renderer: feature id is too high.");
+        }
+
+        pixels[i] = static_cast<std::uint32_t>(val * 100) | 0xff000000;
+    }
+}
+
+#if defined(MAPNIK_RENDER_X86_SIMD)
+
+// 64 bit ids are compared as 64 bit integers, lanes equal to base_mask are exempt
+// from the range check. Blocks with an invalid id are handed to scalar code,
+// which throws the same error. Valid ids fit in 32 bits, so low halves are
+// gathered and multiplied as 32 bit integers.
+
+__attribute__((target("sse4.2")))
+void convert_sse42(std::int64_t const * ids,
+                   std::uint32_t * pixels,
+                   std::size_t count,
+                   std::int64_t base_mask)
+{
+    const __m128i mask = _mm_set1_epi64x(base_mask);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i above = _mm_set1_epi64x(max_id);
+    const __m128i factor = _mm_set1_epi32(100);
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xff000000));
+    std::size_t i = 0;
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i const *>(ids + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<__m128i const *>(ids + i + 2));
+        __m128i masked_a = _mm_cmpeq_epi64(a, mask);
+        __m128i masked_b = _mm_cmpeq_epi64(b, mask);
+        __m128i invalid = _mm_or_si128(
+            _mm_andnot_si128(masked_a, _mm_or_si128(_mm_cmpgt_epi64(a, above), _mm_cmpgt_epi64(zero, a))),
+            _mm_andnot_si128(masked_b, _mm_or_si128(_mm_cmpgt_epi64(b, above), _mm_cmpgt_epi64(zero, b))));
+        if (!_mm_testz_si128(invalid, invalid))
+        {
+            convert_scalar(ids + i, pixels + i, 4, base_mask);
+            continue;
+        }
+
+        // Low 32 bits of the four ids and of the four mask flags.
+        __m128i low = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(2, 0, 2, 0)));
+        __m128i masked = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(masked_a), _mm_castsi128_ps(masked_b), _MM_SHUFFLE(2, 0, 2, 0)));
+        __m128i color = _mm_or_si128(_mm_mullo_epi32(low, factor), alpha);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(pixels + i), _mm_andnot_si128(masked, color));
+    }
+
+    convert_scalar(ids + i, pixels + i, count - i, base_mask);
+}
+
+__attribute__((target("avx2")))
+void convert_avx2(std::int64_t const * ids,
+                  std::uint32_t * pixels,
+                  std::size_t count,
+                  std::int64_t base_mask)
+{
+    const __m256i mask = _mm256_set1_epi64x(base_mask);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i above = _mm256_set1_epi64x(max_id);
+    const __m256i factor = _mm256_set1_epi32(100);
+    const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xff000000));
+    const __m256i low_halves = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+    std::size_t i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(ids + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(ids + i + 4));
+        __m256i masked_a = _mm256_cmpeq_epi64(a, mask);
+        __m256i masked_b = _mm256_cmpeq_epi64(b, mask);
+        __m256i invalid = _mm256_or_si256(
+            _mm256_andnot_si256(masked_a, _mm256_or_si256(_mm256_cmpgt_epi64(a, above), _mm256_cmpgt_epi64(zero, a))),
+            _mm256_andnot_si256(masked_b, _mm256_or_si256(_mm256_cmpgt_epi64(b, above), _mm256_cmpgt_epi64(zero, b))));
+        if (!_mm256_testz_si256(invalid, invalid))
+        {
+            convert_scalar(ids + i, pixels + i, 8, base_mask);
+            continue;
+        }
+
+        // Move low 32 bits of every id to the lower half, then join halves.
+        __m256i low_a = _mm256_permutevar8x32_epi32(a, low_halves);
+        __m256i low_b = _mm256_permutevar8x32_epi32(b, low_halves);
+        __m256i low = _mm256_permute2x128_si256(low_a, low_b, 0x20);
+        __m256i flags_a = _mm256_permutevar8x32_epi32(masked_a, low_halves);
+        __m256i flags_b = _mm256_permutevar8x32_epi32(masked_b, low_halves);
+        __m256i masked = _mm256_permute2x128_si256(flags_a, flags_b, 0x20);
+        __m256i color = _mm256_or_si256(_mm256_mullo_epi32(low, factor), alpha);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(pixels + i), _mm256_andnot_si256(masked, color));
+    }
+
+    convert_sse42(ids + i, pixels + i, count - i, base_mask);
+}
+
+// 32 bit ids, as used by mapnik built without BIGINT, map one to one on
+// pixel lanes.
+
+__attribute__((target("sse4.2")))
+void convert_sse42(std::int32_t const * ids,
+                   std::uint32_t * pixels,
+                   std::size_t count,
+                   std::int32_t base_mask)
+{
+    const __m128i mask = _mm_set1_epi32(base_mask);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i above = _mm_set1_epi32(max_id);
+    const __m128i factor = _mm_set1_epi32(100);
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xff000000));
+    std::size_t i = 0;
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i const *>(ids + i));
+        __m128i masked = _mm_cmpeq_epi32(a, mask);
+        __m128i invalid = _mm_andnot_si128(masked, _mm_or_si128(_mm_cmpgt_epi32(a, above), _mm_cmpgt_epi32(zero, a)));
+        if (!_mm_testz_si128(invalid, invalid))
+        {
+            convert_scalar(ids + i, pixels + i, 4, base_mask);
+            continue;
+        }
+
+        __m128i color = _mm_or_si128(_mm_mullo_epi32(a, factor), alpha);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(pixels + i), _mm_andnot_si128(masked, color));
+    }
+
+    convert_scalar(ids + i, pixels + i, count - i, base_mask);
+}
+
+__attribute__((target("avx2")))
+void convert_avx2(std::int32_t const * ids,
+                  std::uint32_t * pixels,
+                  std::size_t count,
+                  std::int32_t base_mask)
+{
+    const __m256i mask = _mm256_set1_epi32(base_mask);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i above = _mm256_set1_epi32(max_id);
+    const __m256i factor = _mm256_set1_epi32(100);
+    const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xff000000));
+    std::size_t i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(ids + i));
+        __m256i masked = _mm256_cmpeq_epi32(a, mask);
+        __m256i invalid = _mm256_andnot_si256(masked, _mm256_or_si256(_mm256_cmpgt_epi32(a, above), _mm256_cmpgt_epi32(zero, a)));
+        if (!_mm256_testz_si256(invalid, invalid))
+        {
+            convert_scalar(ids + i, pixels + i, 8, base_mask);
+            continue;
+        }
+
+        __m256i color = _mm256_or_si256(_mm256_mullo_epi32(a, factor), alpha);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(pixels + i), _mm256_andnot_si256(masked, color));
+    }
+
+    convert_sse42(ids + i, pixels + i, count - i, base_mask);
+}
+
+#endif
+
+template <typename Id>
+convert_function<Id> select_convert()
+{
+#if defined(MAPNIK_RENDER_X86_SIMD)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return convert_avx2;
+    }
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        return convert_sse42;
+    }
+#endif
+    return convert_scalar<Id>;
+}
+
+}
+
+void convert_grid_ids(std::int64_t const * ids,
+                      std::uint32_t * pixels,
+                      std::size_t count,
+                      std::int64_t base_mask)
+{
+    static const convert_function<std::int64_t> convert = select_convert<std::int64_t>();
+    convert(ids, pixels, count, base_mask);
+}
+
+void convert_grid_ids(std::int32_t const * ids,
+                      std::uint32_t * pixels,
+                      std::size_t count,
+                      std::int32_t base_mask)
+{
+    static const convert_function<std::int32_t> convert = select_convert<std::int32_t>();
+    convert(ids, pixels, count, base_mask);
+}
+
+}
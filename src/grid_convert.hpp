@@ -0,0 +1,51 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#ifndef MAPNIK_RENDER_GRID_CONVERT_HPP
+#define MAPNIK_RENDER_GRID_CONVERT_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mapnik_render
+{
+
+// Converts grid feature ids to opaque pixels of color id * 100, pixels
+// equal to base_mask become transparent. Throws on negative ids and ids
+// too high for 24 bits. Ids are validated and converted with AVX2 or
+// SSE4.2 when available on the running CPU, scalar code otherwise.
+// Overloads cover 64 bit ids of mapnik built with BIGINT and 32 bit ids
+// otherwise.
+void convert_grid_ids(std::int64_t const * ids,
+                      std::uint32_t * pixels,
+                      std::size_t count,
+                      std::int64_t base_mask);
+
+void convert_grid_ids(std::int32_t const * ids,
+                      std::uint32_t * pixels,
+                      std::size_t count,
+                      std::int32_t base_mask);
+
+}
+
+#endif
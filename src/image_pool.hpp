@@ -0,0 +1,116 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#ifndef MAPNIK_RENDER_IMAGE_POOL_HPP
+#define MAPNIK_RENDER_IMAGE_POOL_HPP
+
+#include <map>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <cstring>
+#include <utility>
+
+#include "config.hpp"
+
+namespace mapnik_render
+{
+
+// Images released by finished renders, handed out again to renders of the
+// same size so their memory does not have to be allocated and faulted in
+// anew. Pooled images take at most max_bytes, further ones are freed.
+template <typename ImageType>
+class image_pool
+{
+public:
+    explicit image_pool(std::size_t max_bytes)
+        : max_bytes_(max_bytes),
+          bytes_(0),
+          hits_(0),
+          misses_(0)
+    {
+    }
+
+    image_pool(image_pool const &) = delete;
+    image_pool & operator=(image_pool const &) = delete;
+
+    // Returns cleared image, like a newly constructed one.
+    ImageType acquire(std::size_t width, std::size_t height)
+    {
+        ImageType image;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = free_.find(std::make_pair(width, height));
+            if (it != free_.end() && !it->second.empty())
+            {
+                image = std::move(it->second.back());
+                it->second.pop_back();
+                bytes_ -= image.size();
+            }
+        }
+
+        if (image.size() == 0)
+        {
+            misses_++;
+            return ImageType(width, height);
+        }
+
+        hits_++;
+        // Memory is touched once more, but it is already mapped.
+        std::memset(image.bytes(), 0, image.size());
+        image.set_premultiplied(false);
+        image.painted(false);
+        return image;
+    }
+
+    void release(ImageType && image)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (image.size() == 0 || bytes_ + image.size() > max_bytes_)
+        {
+            return;
+        }
+        bytes_ += image.size();
+        free_[std::make_pair(image.width(), image.height())].push_back(std::move(image));
+    }
+
+    image_pool_usage usage() const
+    {
+        image_pool_usage u;
+        u.hits = hits_;
+        u.misses = misses_;
+        return u;
+    }
+
+private:
+    const std::size_t max_bytes_;
+    std::mutex mutex_;
+    std::map<std::pair<std::size_t, std::size_t>, std::vector<ImageType>> free_;
+    std::size_t bytes_;
+    std::atomic<std::size_t> hits_;
+    std::atomic<std::size_t> misses_;
+};
+
+}
+
+#endif
@@ -0,0 +1,88 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#include "image_writer.hpp"
+
+namespace mapnik_render
+{
+
+image_writer::image_writer(std::size_t threads, std::size_t capacity)
+    : capacity_(capacity ? capacity : 1),
+      pending_(0),
+      pool_(threads)
+{
+}
+
+image_writer::~image_writer()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    drain(lock);
+}
+
+void image_writer::write(std::function<void()> task)
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [this] { return pending_ < capacity_; });
+        pending_++;
+    }
+
+    pool_.submit([this, task](std::size_t)
+    {
+        try
+        {
+            task();
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!error_)
+            {
+                error_ = std::current_exception();
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_--;
+        changed_.notify_all();
+    });
+}
+
+void image_writer::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    drain(lock);
+    if (error_)
+    {
+        std::exception_ptr error(error_);
+        error_ = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+void image_writer::drain(std::unique_lock<std::mutex> & lock)
+{
+    changed_.wait(lock, [this] { return pending_ == 0; });
+}
+
+}
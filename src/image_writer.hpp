@@ -0,0 +1,69 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#ifndef MAPNIK_RENDER_IMAGE_WRITER_HPP
+#define MAPNIK_RENDER_IMAGE_WRITER_HPP
+
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+#include "thread_pool.hpp"
+
+namespace mapnik_render
+{
+
+// Background stage encoding and writing output images on its own pool.
+// At most capacity tasks are queued or running, write() blocks otherwise.
+// Tasks are expected to handle their errors, the first exception escaping
+// a task is rethrown by wait().
+class image_writer
+{
+public:
+    image_writer(std::size_t threads, std::size_t capacity);
+    ~image_writer();
+
+    image_writer(image_writer const &) = delete;
+    image_writer & operator=(image_writer const &) = delete;
+
+    void write(std::function<void()> task);
+
+    // Blocks until all submitted tasks are done.
+    void wait();
+
+private:
+    void drain(std::unique_lock<std::mutex> & lock);
+
+    const std::size_t capacity_;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::size_t pending_;
+    std::exception_ptr error_;
+    // Declared last to be destroyed first, workers use members above.
+    thread_pool pool_;
+};
+
+}
+
+#endif
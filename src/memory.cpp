@@ -0,0 +1,200 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#include <new>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <sstream>
+
+#include <malloc.h>
+
+#include "memory.hpp"
+
+namespace mapnik_render
+{
+
+namespace
+{
+
+thread_local memory_counters * current_counters = nullptr;
+
+void * allocate(std::size_t size)
+{
+    void * ptr = std::malloc(size ? size : 1);
+    if (ptr && current_counters)
+    {
+        current_counters->allocated(malloc_usable_size(ptr));
+    }
+    return ptr;
+}
+
+void * allocate_or_throw(std::size_t size)
+{
+    while (true)
+    {
+        if (void * ptr = allocate(size))
+        {
+            return ptr;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (!handler)
+        {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+void deallocate(void * ptr)
+{
+    if (ptr && current_counters)
+    {
+        current_counters->deallocated(malloc_usable_size(ptr));
+    }
+    std::free(ptr);
+}
+
+}
+
+void memory_counters::allocated(std::size_t bytes)
+{
+    allocations_.fetch_add(1, std::memory_order_relaxed);
+    bytes_.fetch_add(bytes, std::memory_order_relaxed);
+    std::int64_t live = live_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    std::int64_t peak = peak_.load(std::memory_order_relaxed);
+    while (live > peak && !peak_.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+    {
+    }
+}
+
+void memory_counters::deallocated(std::size_t bytes)
+{
+    live_.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+memory_usage memory_counters::usage() const
+{
+    memory_usage usage;
+    usage.allocations = allocations_.load(std::memory_order_relaxed);
+    usage.bytes = bytes_.load(std::memory_order_relaxed);
+    usage.peak_heap = static_cast<std::uint64_t>(peak_.load(std::memory_order_relaxed));
+    return usage;
+}
+
+memory_scope::memory_scope(memory_counters * counters)
+    : previous_(current_counters)
+{
+    current_counters = counters;
+}
+
+memory_scope::~memory_scope()
+{
+    current_counters = previous_;
+}
+
+memory_counters * memory_scope::current()
+{
+    return current_counters;
+}
+
+void read_rss(memory_usage & usage)
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+    {
+        std::uint64_t * field = nullptr;
+        if (line.compare(0, 6, "VmRSS:") == 0)
+        {
+            field = &usage.rss;
+        }
+        else if (line.compare(0, 6, "VmHWM:") == 0)
+        {
+            field = &usage.peak_rss;
+        }
+        if (field)
+        {
+            std::istringstream value(line.substr(6));
+            std::uint64_t kilobytes = 0;
+            value >> kilobytes;
+            *field = kilobytes * 1024;
+        }
+    }
+}
+
+}
+
+void * operator new(std::size_t size)
+{
+    return mapnik_render::allocate_or_throw(size);
+}
+
+void * operator new[](std::size_t size)
+{
+    return mapnik_render::allocate_or_throw(size);
+}
+
+void * operator new(std::size_t size, std::nothrow_t const &) noexcept
+{
+    try
+    {
+        return mapnik_render::allocate_or_throw(size);
+    }
+    catch (std::bad_alloc const &)
+    {
+        return nullptr;
+    }
+}
+
+void * operator new[](std::size_t size, std::nothrow_t const &) noexcept
+{
+    try
+    {
+        return mapnik_render::allocate_or_throw(size);
+    }
+    catch (std::bad_alloc const &)
+    {
+        return nullptr;
+    }
+}
+
+void operator delete(void * ptr) noexcept
+{
+    mapnik_render::deallocate(ptr);
+}
+
+void operator delete[](void * ptr) noexcept
+{
+    mapnik_render::deallocate(ptr);
+}
+
+void operator delete(void * ptr, std::nothrow_t const &) noexcept
+{
+    mapnik_render::deallocate(ptr);
+}
+
+void operator delete[](void * ptr, std::nothrow_t const &) noexcept
+{
+    mapnik_render::deallocate(ptr);
+}
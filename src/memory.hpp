@@ -0,0 +1,78 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#ifndef MAPNIK_RENDER_MEMORY_HPP
+#define MAPNIK_RENDER_MEMORY_HPP
+
+#include <atomic>
+#include <cstdint>
+
+#include "config.hpp"
+
+namespace mapnik_render
+{
+
+// Heap usage collected by replaced global operator new and delete. Counters
+// are updated only on threads inside memory_scope, so untracked code pays
+// for a thread-local read only.
+class memory_counters
+{
+public:
+    void allocated(std::size_t bytes);
+    void deallocated(std::size_t bytes);
+
+    // Allocation count, bytes and peak live heap relative to construction.
+    memory_usage usage() const;
+
+private:
+    std::atomic<std::uint64_t> allocations_ { 0 };
+    std::atomic<std::uint64_t> bytes_ { 0 };
+    std::atomic<std::int64_t> live_ { 0 };
+    std::atomic<std::int64_t> peak_ { 0 };
+};
+
+// Attributes allocations of current thread to counters while in scope.
+// Tasks running on behalf of a tracked render on other threads open their
+// own scope with the counters of the submitting thread.
+class memory_scope
+{
+public:
+    explicit memory_scope(memory_counters * counters);
+    ~memory_scope();
+
+    memory_scope(memory_scope const &) = delete;
+    memory_scope & operator=(memory_scope const &) = delete;
+
+    static memory_counters * current();
+
+private:
+    memory_counters * previous_;
+};
+
+// Current and peak resident set size of the process from /proc/self/status,
+// zero where not available.
+void read_rss(memory_usage & usage);
+
+}
+
+#endif
@@ -0,0 +1,532 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iterator>
+#include <set>
+
+#include <boost/algorithm/string.hpp>
+
+#include "render_cache.hpp"
+#include "sink.hpp"
+
+namespace mapnik_render
+{
+
+namespace
+{
+
+const char * const cache_header = "mapnik-render-cache 3";
+
+std::string read_file(boost::filesystem::path const & path)
+{
+    std::ifstream stream(path.string().c_str(), std::ios_base::in | std::ios_base::binary);
+    if (!stream)
+    {
+        throw std::runtime_error("Cannot open file: " + path.string());
+    }
+    return std::string(std::istreambuf_iterator<char>(stream.rdbuf()), std::istreambuf_iterator<char>());
+}
+
+std::uint64_t hash_string(std::string const & s)
+{
+    return checksum(s.data(), s.size());
+}
+
+// Hashes file in chunks, so that big datasources are never held in memory
+// whole.
+std::uint64_t hash_file(boost::filesystem::path const & path)
+{
+    std::ifstream stream(path.string().c_str(), std::ios_base::in | std::ios_base::binary);
+    if (!stream)
+    {
+        throw std::runtime_error("Cannot open file: " + path.string());
+    }
+
+    std::vector<char> buffer(1 << 20);
+    std::vector<std::uint64_t> hashes;
+    while (stream)
+    {
+        stream.read(buffer.data(), buffer.size());
+        std::streamsize count = stream.gcount();
+        if (count > 0)
+        {
+            hashes.push_back(checksum(buffer.data(), static_cast<std::size_t>(count)));
+        }
+    }
+    return checksum(hashes.data(), hashes.size() * sizeof(std::uint64_t));
+}
+
+// Every quoted attribute value and every text node of the XML is tried as
+// a path relative to the style. Shapefiles bring their companion files.
+std::set<boost::filesystem::path> referenced_files(std::string const & xml,
+                                                   boost::filesystem::path const & base)
+{
+    static const std::vector<std::string> shapefile_parts { ".dbf", ".shx", ".prj", ".index", ".qix", ".cpg" };
+
+    std::vector<std::string> candidates;
+    bool in_tag = false;
+    for (std::size_t pos = 0; pos < xml.size(); pos++)
+    {
+        char c = xml[pos];
+        if (c == '<')
+        {
+            in_tag = true;
+        }
+        else if (c == '>')
+        {
+            in_tag = false;
+            std::size_t end = xml.find('<', pos + 1);
+            if (end == std::string::npos)
+            {
+                break;
+            }
+            candidates.push_back(xml.substr(pos + 1, end - pos - 1));
+            pos = end - 1;
+        }
+        else if (in_tag && (c == '"' || c == '\''))
+        {
+            std::size_t end = xml.find(c, pos + 1);
+            if (end == std::string::npos)
+            {
+                break;
+            }
+            candidates.push_back(xml.substr(pos + 1, end - pos - 1));
+            pos = end;
+        }
+    }
+
+    std::set<boost::filesystem::path> files;
+
+    for (std::string & candidate : candidates)
+    {
+        boost::algorithm::trim(candidate);
+        if (candidate.empty() || candidate.size() > 4096 || candidate.find('\n') != std::string::npos)
+        {
+            continue;
+        }
+
+        boost::system::error_code ec;
+        boost::filesystem::path path(candidate);
+        if (path.is_relative())
+        {
+            path = base / path;
+        }
+        if (!boost::filesystem::exists(path, ec))
+        {
+            boost::filesystem::path shp(path.string() + ".shp");
+            if (!boost::filesystem::exists(shp, ec))
+            {
+                continue;
+            }
+            path = shp;
+        }
+
+        files.insert(path);
+
+        if (path.extension() == ".shp")
+        {
+            for (auto const & part : shapefile_parts)
+            {
+                boost::filesystem::path companion(path);
+                companion.replace_extension(part);
+                if (boost::filesystem::exists(companion, ec))
+                {
+                    files.insert(companion);
+                }
+            }
+        }
+    }
+
+    return files;
+}
+
+
+std::string optional_hex(boost::optional<std::uint64_t> const & value)
+{
+    if (!value)
+    {
+        return "-";
+    }
+    std::ostringstream s;
+    s << std::hex << *value;
+    return s.str();
+}
+
+boost::optional<std::uint64_t> parse_optional_hex(std::string const & value)
+{
+    if (value == "-")
+    {
+        return boost::none;
+    }
+    return std::stoull(value, nullptr, 16);
+}
+
+const char * const jobs_tag = "jobs";
+
+// Job as width;height;scale;tiles_x;tiles_y;renderer;envelope or all.
+std::string format_job(job const & j)
+{
+    std::ostringstream s;
+    s << std::setprecision(17)
+      << j.size.width << ';' << j.size.height << ';' << j.scale_factor << ';'
+      << j.tiles.width << ';' << j.tiles.height << ';' << j.renderer_index << ';';
+    if (j.envelope)
+    {
+        s << j.envelope->minx() << ',' << j.envelope->miny() << ','
+          << j.envelope->maxx() << ',' << j.envelope->maxy();
+    }
+    else
+    {
+        s << "all";
+    }
+    return s.str();
+}
+
+job parse_job(std::string const & text)
+{
+    std::vector<std::string> fields;
+    boost::algorithm::split(fields, text, boost::algorithm::is_any_of(";"));
+    if (fields.size() != 7)
+    {
+        throw std::runtime_error("Malformed job: " + text);
+    }
+    job j;
+    j.size = map_size(std::stoul(fields[0]), std::stoul(fields[1]));
+    j.scale_factor = std::stod(fields[2]);
+    j.tiles = map_size(std::stoul(fields[3]), std::stoul(fields[4]));
+    j.renderer_index = std::stoul(fields[5]);
+    if (fields[6] != "all")
+    {
+        mapnik::box2d<double> box;
+        if (!box.from_string(fields[6]))
+        {
+            throw std::runtime_error("Malformed envelope: " + fields[6]);
+        }
+        j.envelope = box;
+    }
+    return j;
+}
+
+}
+
+render_cache::render_cache(boost::filesystem::path const & file,
+                           std::string const & context,
+                           bool check_output,
+                           boost::optional<boost::filesystem::path> const & reference_dir)
+    : file_(file),
+      context_(context),
+      check_output_(check_output),
+      reference_dir_(reference_dir)
+{
+}
+
+void render_cache::load()
+{
+    std::ifstream stream(file_.string().c_str());
+    if (!stream)
+    {
+        return;
+    }
+
+    std::string line;
+    if (!std::getline(stream, line) || line != cache_header)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    while (std::getline(stream, line))
+    {
+        std::vector<std::string> fields;
+        boost::algorithm::split(fields, line, boost::algorithm::is_any_of("\t"));
+        if (fields.size() >= 2 && fields[0] == jobs_tag)
+        {
+            try
+            {
+                std::vector<job> jobs;
+                for (std::size_t i = 2; i < fields.size(); i++)
+                {
+                    jobs.push_back(parse_job(fields[i]));
+                }
+                jobs_[std::stoull(fields[1], nullptr, 16)] = std::move(jobs);
+            }
+            catch (std::exception const &)
+            {
+                // Styles of malformed entries are loaded again.
+            }
+            continue;
+        }
+        if (fields.size() != 21)
+        {
+            continue;
+        }
+
+        try
+        {
+            entry e;
+            result & r = e.res;
+            std::uint64_t key = std::stoull(fields[0], nullptr, 16);
+            e.reference_hash = parse_optional_hex(fields[1]);
+            r.state = static_cast<result_state>(std::stoi(fields[2]));
+            r.name = fields[3];
+            r.renderer_name = fields[4];
+            r.size = map_size(std::stoul(fields[5]), std::stoul(fields[6]));
+            r.tiles = map_size(std::stoul(fields[7]), std::stoul(fields[8]));
+            r.scale_factor = std::stod(fields[9]);
+            r.image_path = fields[10];
+            r.duration = duration_type(std::stoll(fields[11]));
+            if (!fields[12].empty())
+            {
+                std::vector<std::string> samples;
+                boost::algorithm::split(samples, fields[12], boost::algorithm::is_any_of(","));
+                for (auto const & sample : samples)
+                {
+                    r.samples.emplace_back(std::stoll(sample));
+                }
+            }
+            r.statistics = compute_statistics(r.samples);
+            r.tiles_duration = duration_type(std::stoll(fields[15]));
+            r.phases.load_map = duration_type(std::stoll(fields[16]));
+            r.phases.zoom = duration_type(std::stoll(fields[17]));
+            r.phases.render = duration_type(std::stoll(fields[18]));
+            r.phases.encode = duration_type(std::stoll(fields[19]));
+            r.phases.write = duration_type(std::stoll(fields[20]));
+            r.checksum = parse_optional_hex(fields[13]);
+            if (fields[14] != "-")
+            {
+                r.mismatched_pixels = std::stoull(fields[14]);
+            }
+            entries_[key] = std::move(e);
+        }
+        catch (std::exception const &)
+        {
+            // Ignore malformed entries, they are rendered again.
+        }
+    }
+}
+
+void render_cache::save() const
+{
+    boost::filesystem::path tmp(file_.string() + ".tmp");
+
+    {
+        std::ofstream stream(tmp.string().c_str(), std::ios::out | std::ios::trunc);
+        if (!stream)
+        {
+            throw std::runtime_error("Cannot open file for writing: " + tmp.string());
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        stream << cache_header << '\n';
+        for (auto const & item : entries_)
+        {
+            result const & r = item.second.res;
+            stream << std::hex << item.first << std::dec << '\t'
+                   << optional_hex(item.second.reference_hash) << '\t'
+                   << static_cast<int>(r.state) << '\t'
+                   << r.name << '\t'
+                   << r.renderer_name << '\t'
+                   << r.size.width << '\t' << r.size.height << '\t'
+                   << r.tiles.width << '\t' << r.tiles.height << '\t'
+                   << std::setprecision(17) << r.scale_factor << '\t'
+                   << r.image_path.string() << '\t'
+                   << r.duration.count() << '\t';
+            for (std::size_t i = 0; i < r.samples.size(); i++)
+            {
+                stream << (i ? "," : "") << r.samples[i].count();
+            }
+            stream << '\t' << optional_hex(r.checksum) << '\t';
+            if (r.mismatched_pixels)
+            {
+                stream << *r.mismatched_pixels;
+            }
+            else
+            {
+                stream << '-';
+            }
+            stream << '\t' << r.tiles_duration.count()
+                   << '\t' << r.phases.load_map.count()
+                   << '\t' << r.phases.zoom.count()
+                   << '\t' << r.phases.render.count()
+                   << '\t' << r.phases.encode.count()
+                   << '\t' << r.phases.write.count();
+            stream << '\n';
+        }
+        for (auto const & item : jobs_)
+        {
+            stream << jobs_tag << '\t' << std::hex << item.first << std::dec;
+            for (auto const & j : item.second)
+            {
+                stream << '\t' << format_job(j);
+            }
+            stream << '\n';
+        }
+    }
+
+    boost::filesystem::rename(tmp, file_);
+}
+
+std::uint64_t render_cache::path_hash(boost::filesystem::path const & path)
+{
+    if (boost::filesystem::is_regular_file(path))
+    {
+        return hash_file(path);
+    }
+
+    std::set<std::string> listing;
+    boost::system::error_code ec;
+    for (boost::filesystem::recursive_directory_iterator it(path, ec), end; !ec && it != end; it.increment(ec))
+    {
+        if (boost::filesystem::is_regular_file(it->path()))
+        {
+            std::ostringstream s;
+            s << it->path().string().substr(path.string().size()) << ':' << boost::filesystem::file_size(it->path());
+            listing.insert(s.str());
+        }
+    }
+    return hash_string(boost::algorithm::join(listing, "\n"));
+}
+
+std::uint64_t render_cache::style_hash(boost::filesystem::path const & style_path) const
+{
+    std::string xml(read_file(style_path));
+    std::vector<std::uint64_t> hashes { hash_string(xml) };
+
+    for (auto const & path : referenced_files(xml, style_path.parent_path()))
+    {
+        hashes.push_back(hash_string(path.string()));
+        hashes.push_back(path_hash(path));
+    }
+
+    return checksum(hashes.data(), hashes.size() * sizeof(std::uint64_t));
+}
+
+std::uint64_t render_cache::key(job const & j, std::string const & renderer_name) const
+{
+    std::ostringstream s;
+    s << context_ << '\n'
+      << std::hex << j.style_hash << std::dec << '\n'
+      << j.style_path.string() << '\n'
+      << renderer_name << '\n'
+      << j.size.width << 'x' << j.size.height << '\n'
+      << std::setprecision(17) << j.scale_factor << '\n'
+      << j.tiles.width << 'x' << j.tiles.height << '\n';
+    if (j.envelope)
+    {
+        s << j.envelope->minx() << ',' << j.envelope->miny() << ','
+          << j.envelope->maxx() << ',' << j.envelope->maxy();
+    }
+    else
+    {
+        s << "all";
+    }
+    return hash_string(s.str());
+}
+
+boost::optional<result> render_cache::find(std::uint64_t key) const
+{
+    entry e;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(key);
+        if (it == entries_.end())
+        {
+            return boost::none;
+        }
+        e = it->second;
+    }
+
+    if (check_output_ && !boost::filesystem::exists(e.res.image_path))
+    {
+        return boost::none;
+    }
+
+    if (reference_hash(e.res) != e.reference_hash)
+    {
+        return boost::none;
+    }
+
+    return e.res;
+}
+
+void render_cache::store(std::uint64_t key, result const & r)
+{
+    entry e;
+    e.res = r;
+    e.reference_hash = reference_hash(r);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_[key] = std::move(e);
+}
+
+boost::optional<std::vector<job>> render_cache::find_jobs(std::uint64_t key) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = jobs_.find(key);
+    if (it == jobs_.end())
+    {
+        return boost::none;
+    }
+    return it->second;
+}
+
+void render_cache::store_jobs(std::uint64_t key, std::vector<job> const & jobs)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<job> & stored = jobs_[key];
+    stored.clear();
+    for (auto const & j : jobs)
+    {
+        job kept;
+        kept.size = j.size;
+        kept.scale_factor = j.scale_factor;
+        kept.tiles = j.tiles;
+        kept.renderer_index = j.renderer_index;
+        kept.envelope = j.envelope;
+        stored.push_back(kept);
+    }
+}
+
+boost::optional<std::uint64_t> render_cache::reference_hash(result const & r) const
+{
+    if (!reference_dir_)
+    {
+        return boost::none;
+    }
+
+    boost::filesystem::path reference(*reference_dir_ / r.image_path.filename());
+    if (!boost::filesystem::exists(reference))
+    {
+        return boost::none;
+    }
+
+    return path_hash(reference);
+}
+
+}
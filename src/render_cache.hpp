@@ -0,0 +1,96 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#ifndef MAPNIK_RENDER_RENDER_CACHE_HPP
+#define MAPNIK_RENDER_RENDER_CACHE_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <cstdint>
+
+#include <boost/filesystem.hpp>
+#include <boost/optional.hpp>
+
+#include "config.hpp"
+
+namespace mapnik_render
+{
+
+// Persistent results of previous runs keyed by hash of everything the
+// output depends on: style XML with files it references, job parameters,
+// renderer and context describing output options.
+class render_cache
+{
+public:
+    render_cache(boost::filesystem::path const & file,
+                 std::string const & context,
+                 bool check_output,
+                 boost::optional<boost::filesystem::path> const & reference_dir);
+
+    void load();
+    void save() const;
+
+    // Hash of style XML and of all files referenced from it.
+    std::uint64_t style_hash(boost::filesystem::path const & style_path) const;
+
+    // Regular files are hashed by content, directories (e.g. fonts) by
+    // relative paths and sizes of all files below them.
+    static std::uint64_t path_hash(boost::filesystem::path const & path);
+
+    std::uint64_t key(job const & j, std::string const & renderer_name) const;
+
+    // Returns stored result if its output and reference image are unchanged.
+    boost::optional<result> find(std::uint64_t key) const;
+
+    void store(std::uint64_t key, result const & r);
+
+    // Jobs expanded from a style, keyed by hash of the style and everything
+    // else expansion depends on. Only size, scale factor, tiles, renderer
+    // index and envelope are kept.
+    boost::optional<std::vector<job>> find_jobs(std::uint64_t key) const;
+
+    void store_jobs(std::uint64_t key, std::vector<job> const & jobs);
+
+private:
+    struct entry
+    {
+        result res;
+        boost::optional<std::uint64_t> reference_hash;
+    };
+
+    boost::optional<std::uint64_t> reference_hash(result const & r) const;
+
+    const boost::filesystem::path file_;
+    const std::string context_;
+    const bool check_output_;
+    const boost::optional<boost::filesystem::path> reference_dir_;
+    mutable std::mutex mutex_;
+    std::map<std::uint64_t, entry> entries_;
+    std::map<std::uint64_t, std::vector<job>> jobs_;
+};
+
+}
+
+#endif
@@ -27,6 +27,13 @@
 #include <iomanip>
 #include <fstream>
 #include <memory>
+#include <chrono>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <iterator>
+#include <cstring>
+#include <type_traits>
 
 #include <mapnik/map.hpp>
 #include <mapnik/image_util.hpp>
@@ -39,7 +46,6 @@
 
 #if defined(HAVE_CAIRO)
 #include <mapnik/cairo/cairo_renderer.hpp>
-#include <mapnik/cairo/cairo_image_util.hpp>
 #ifdef CAIRO_HAS_SVG_SURFACE
 #include <cairo-svg.h>
 #endif
@@ -59,9 +65,122 @@
 
 #include <boost/filesystem.hpp>
 
+#include "config.hpp"
+#include "thread_pool.hpp"
+#include "image_writer.hpp"
+#include "sink.hpp"
+#include "compare.hpp"
+#include "memory.hpp"
+#include "image_pool.hpp"
+#include "grid_convert.hpp"
+#include "utfgrid.hpp"
+#include "spool.hpp"
+#include "cairo_convert.hpp"
+#include "trace.hpp"
+
 namespace mapnik_render
 {
 
+enum parallelizer_mode : std::uint8_t
+{
+    // AGG renders with mapnik::parallelizer whenever the map allows it ...
+    PARALLELIZER_AUTO,
+    PARALLELIZER_OFF,
+    // ... always, failing on maps which do not allow it ...
+    PARALLELIZER_ON,
+    // ... or as in auto mode, rendering each job serially too for comparison.
+    PARALLELIZER_COMPARE
+};
+
+inline parallelizer_mode parse_parallelizer_mode(std::string const & name)
+{
+    if (name == "auto")
+    {
+        return PARALLELIZER_AUTO;
+    }
+    if (name == "off")
+    {
+        return PARALLELIZER_OFF;
+    }
+    if (name == "on")
+    {
+        return PARALLELIZER_ON;
+    }
+    if (name == "compare")
+    {
+        return PARALLELIZER_COMPARE;
+    }
+    throw std::runtime_error("Unknown parallelizer mode: " + name);
+}
+
+// Whether this mapnik build lets parallelizer use a given number of threads.
+template <typename Image, typename = void>
+struct parallelizer_threads_support : std::false_type
+{
+};
+
+template <typename Image>
+struct parallelizer_threads_support<Image, decltype(void(mapnik::parallelizer::render(
+    std::declval<mapnik::Map const &>(), std::declval<Image &>(), 0.0, 0.0, std::size_t(0))))> : std::true_type
+{
+};
+
+// Whether renderer compares its encoded output with reference, declared by
+// compare_encoded. Such output is encoded once for comparison and sink.
+template <typename Renderer, typename = void>
+struct compares_encoded : std::false_type
+{
+};
+
+template <typename Renderer>
+struct compares_encoded<Renderer, typename std::enable_if<Renderer::compare_encoded>::type> : std::true_type
+{
+};
+
+struct renderer_options
+{
+    boost::filesystem::path output_dir;
+    sink_type sink;
+    // Renders tiles concurrently if set.
+    std::shared_ptr<thread_pool> tile_pool;
+    // Saves images in background if set.
+    std::shared_ptr<image_writer> writer;
+    // Compares images to references of the same name if set.
+    boost::optional<boost::filesystem::path> reference_dir;
+    // Maximal difference of a channel for pixels to be considered equal.
+    unsigned tolerance = 0;
+    // Reuses raster images of finished renders if set.
+    std::shared_ptr<image_pool<mapnik::image_rgba8>> buffers;
+    // UTFGrid samples every grid_resolution-th pixel and lists grid_fields of features.
+    unsigned grid_resolution = 4;
+    std::vector<std::string> grid_fields;
+    parallelizer_mode parallelizer = PARALLELIZER_AUTO;
+    // Parallelizer threads, 0 leaves the choice to mapnik.
+    std::size_t parallelizer_threads = 0;
+    // Renders tiled jobs also one by one when tile pool is set, to measure
+    // speedup of concurrent tiles.
+    bool tile_compare = false;
+};
+
+// Number of bytes differing from reference file, missing or extra bytes included.
+inline std::size_t compare_bytes(std::string const & actual, boost::filesystem::path const & reference)
+{
+    std::ifstream stream(reference.string().c_str(), std::ios_base::in | std::ios_base::binary);
+    if (!stream)
+    {
+        throw std::runtime_error("Could not open reference file: " + reference.string());
+    }
+    std::string expected(std::istreambuf_iterator<char>(stream.rdbuf()), std::istreambuf_iterator<char>());
+
+    std::size_t common = std::min(actual.size(), expected.size());
+    std::size_t different = std::max(actual.size(), expected.size()) - common;
+    for (std::size_t i = 0; i < common; i++)
+    {
+        different += actual[i] != expected[i];
+    }
+    return different;
+}
+
 template <typename ImageType>
 struct raster_renderer_base
 {
@@ -70,41 +189,131 @@ struct raster_renderer_base
     static constexpr const char * ext = ".png";
     static constexpr const bool support_tiles = true;
 
-    void save(image_type const & image, boost::filesystem::path const& path) const
+    explicit raster_renderer_base(renderer_options const & options)
+        : buffers(options.buffers)
+    {
+    }
+
+    image_type create(std::size_t width, std::size_t height) const
+    {
+        return buffers ? buffers->acquire(width, height) : image_type(width, height);
+    }
+
+    // Gives image of a finished render back to the pool.
+    void recycle(image_type && image) const
     {
-        mapnik::save_to_file(image, path.string(), "png32");
+        if (buffers)
+        {
+            buffers->release(std::move(image));
+        }
+    }
+
+    std::string encode(image_type const & image) const
+    {
+        return mapnik::save_to_string(image, "png32");
     }
+
+    std::pair<void const *, std::size_t> raw(image_type const & image) const
+    {
+        return std::make_pair(static_cast<void const *>(image.bytes()), image.size());
+    }
+
+    std::size_t compare(image_type const & actual, boost::filesystem::path const& reference, unsigned tolerance) const
+    {
+        std::unique_ptr<mapnik::image_reader> reader(mapnik::get_image_reader(reference.string(), "png"));
+        if (!reader.get())
+        {
+            throw std::runtime_error("Could not load reference image: " + reference.string());
+        }
+
+        if (reader->width() != actual.width() || reader->height() != actual.height())
+        {
+            return actual.width() * actual.height();
+        }
+
+        image_type expected(reader->width(), reader->height());
+        reader->read(0, 0, expected);
+
+        return compare_pixels(reinterpret_cast<std::uint32_t const *>(actual.bytes()),
+                              reinterpret_cast<std::uint32_t const *>(expected.bytes()),
+                              actual.width() * actual.height(),
+                              tolerance);
+    }
+
+    const std::shared_ptr<image_pool<image_type>> buffers;
 };
 
-struct vector_renderer_base
+// Vector output streamed to a spool file while rendering. Nothing is spooled
+// when output is neither stored nor compared. Files are spooled next to the
+// output, so they can be renamed into place, only for the file sink and to
+// the temporary directory otherwise.
+struct spooled_renderer_base
 {
-    using image_type = std::string;
+    using image_type = spooled_output;
 
     static constexpr const bool support_tiles = false;
 
-    void save(image_type const & image, boost::filesystem::path const& path) const
+    explicit spooled_renderer_base(renderer_options const & options)
+        : directory(options.sink.is<file_sink>() ? options.output_dir : boost::filesystem::temp_directory_path()),
+          discard(options.sink.is<null_sink>() && !options.reference_dir)
     {
-        std::ofstream file(path.string().c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
-        if (!file)
-        {
-            throw std::runtime_error("Cannot open file for writing: " + path.string());
-        }
-        file << image;
     }
+
+    image_type spool() const
+    {
+        return discard ? spooled_output() : spooled_output(directory);
+    }
+
+    void recycle(image_type &&) const
+    {
+    }
+
+    std::string encode(image_type const & output) const
+    {
+        return output.read();
+    }
+
+    std::size_t compare(image_type const & actual, boost::filesystem::path const& reference, unsigned) const
+    {
+        return actual.compare(reference);
+    }
+
+    const boost::filesystem::path directory;
+    const bool discard;
 };
 
 struct agg_renderer : raster_renderer_base<mapnik::image_rgba8>
 {
     static constexpr const char * name = "agg";
 
+    explicit agg_renderer(renderer_options const & options)
+        : raster_renderer_base(options),
+          parallelizer(options.parallelizer),
+          threads(options.parallelizer_threads)
+    {
+    }
+
     image_type render(mapnik::Map const & map, double scale_factor) const
     {
-        image_type image(map.width(), map.height());
+        if (parallelizer == PARALLELIZER_OFF)
+        {
+            return render(map, scale_factor, false);
+        }
+        bool parallelizable = mapnik::parallelizer::is_parallelizable(map);
+        if (parallelizer == PARALLELIZER_ON && !parallelizable)
+        {
+            throw std::runtime_error("Map is not parallelizable");
+        }
+        return render(map, scale_factor, parallelizable);
+    }
+
+    image_type render(mapnik::Map const & map, double scale_factor, bool parallel) const
+    {
+        image_type image(create(map.width(), map.height()));
 
-        if (mapnik::parallelizer::is_parallelizable(map))
+        if (parallel)
         {
-            const double scale_denom = 0;
-            mapnik::parallelizer::render(map, image, scale_denom, scale_factor);
+            render_parallel(map, image, scale_factor, parallelizer_threads_support<image_type>());
         }
         else
         {
@@ -114,23 +323,73 @@ struct agg_renderer : raster_renderer_base<mapnik::image_rgba8>
 
         return image;
     }
+
+    const parallelizer_mode parallelizer;
+    const std::size_t threads;
+
+private:
+    template <typename Image>
+    void render_parallel(mapnik::Map const & map, Image & image, double scale_factor, std::true_type) const
+    {
+        const double scale_denom = 0;
+        if (threads > 0)
+        {
+            mapnik::parallelizer::render(map, image, scale_denom, scale_factor, threads);
+        }
+        else
+        {
+            mapnik::parallelizer::render(map, image, scale_denom, scale_factor);
+        }
+    }
+
+    template <typename Image>
+    void render_parallel(mapnik::Map const & map, Image & image, double scale_factor, std::false_type) const
+    {
+        const double scale_denom = 0;
+        mapnik::parallelizer::render(map, image, scale_denom, scale_factor);
+    }
 };
 
+// Whether renderer hands rendering of map to other threads.
+template <typename Renderer>
+bool renders_in_parallel(Renderer const &, mapnik::Map const &)
+{
+    return false;
+}
+
+inline bool renders_in_parallel(agg_renderer const & ren, mapnik::Map const & map)
+{
+    return ren.parallelizer != PARALLELIZER_OFF && mapnik::parallelizer::is_parallelizable(map);
+}
+
 #if defined(HAVE_CAIRO)
 struct cairo_renderer : raster_renderer_base<mapnik::image_rgba8>
 {
     static constexpr const char * name = "cairo";
 
+    using raster_renderer_base::raster_renderer_base;
+
+    // Cairo draws straight into the image buffer, which is then converted
+    // to demultiplied RGBA in place.
     image_type render(mapnik::Map const & map, double scale_factor) const
     {
-        mapnik::cairo_surface_ptr image_surface(
-            cairo_image_surface_create(CAIRO_FORMAT_ARGB32, map.width(), map.height()),
-            mapnik::cairo_surface_closer());
-        mapnik::cairo_ptr image_context(mapnik::create_context(image_surface));
-        mapnik::cairo_renderer<mapnik::cairo_ptr> ren(map, image_context, scale_factor);
-        ren.apply();
-        image_type image(map.width(), map.height());
-        mapnik::cairo_image_to_rgba8(image, image_surface);
+        image_type image(create(map.width(), map.height()));
+        const int stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, image.width());
+        if (stride != static_cast<int>(image.width() * sizeof(image_type::pixel_type)))
+        {
+            throw std::runtime_error("Unsupported cairo image stride");
+        }
+        {
+            mapnik::cairo_surface_ptr image_surface(
+                cairo_image_surface_create_for_data(image.bytes(), CAIRO_FORMAT_ARGB32,
+                                                    image.width(), image.height(), stride),
+                mapnik::cairo_surface_closer());
+            mapnik::cairo_ptr image_context(mapnik::create_context(image_surface));
+            mapnik::cairo_renderer<mapnik::cairo_ptr> ren(map, image_context, scale_factor);
+            ren.apply();
+            cairo_surface_flush(&*image_surface);
+        }
+        cairo_argb_to_rgba(image.data(), image.width() * image.height());
         return image;
     }
 };
@@ -138,28 +397,37 @@ struct cairo_renderer : raster_renderer_base<mapnik::image_rgba8>
 using surface_create_type = cairo_surface_t *(&)(cairo_write_func_t, void *, double, double);
 
 template <surface_create_type SurfaceCreateFunction>
-struct cairo_vector_renderer : vector_renderer_base
+struct cairo_vector_renderer : spooled_renderer_base
 {
+    using spooled_renderer_base::spooled_renderer_base;
+
     static cairo_status_t write(void *closure,
                                 const unsigned char *data,
                                 unsigned int length)
     {
-        std::ostringstream & ss = *reinterpret_cast<std::ostringstream*>(closure);
-        ss.write(reinterpret_cast<char const *>(data), length);
-        return ss ? CAIRO_STATUS_SUCCESS : CAIRO_STATUS_WRITE_ERROR;
+        spooled_output & output = *reinterpret_cast<spooled_output*>(closure);
+        return output.write(data, length) ? CAIRO_STATUS_SUCCESS : CAIRO_STATUS_WRITE_ERROR;
     }
 
     image_type render(mapnik::Map const & map, double scale_factor) const
     {
-        std::ostringstream ss(std::stringstream::binary);
-        mapnik::cairo_surface_ptr image_surface(
-            SurfaceCreateFunction(write, &ss, map.width(), map.height()),
-            mapnik::cairo_surface_closer());
-        mapnik::cairo_ptr image_context(mapnik::create_context(image_surface));
-        mapnik::cairo_renderer<mapnik::cairo_ptr> ren(map, image_context, scale_factor);
-        ren.apply();
-        cairo_surface_finish(&*image_surface);
-        return ss.str();
+        image_type output(spool());
+        {
+            mapnik::cairo_surface_ptr image_surface(
+                SurfaceCreateFunction(write, &output, map.width(), map.height()),
+                mapnik::cairo_surface_closer());
+            mapnik::cairo_ptr image_context(mapnik::create_context(image_surface));
+            mapnik::cairo_renderer<mapnik::cairo_ptr> ren(map, image_context, scale_factor);
+            ren.apply();
+            cairo_surface_finish(&*image_surface);
+            if (cairo_surface_status(&*image_surface) != CAIRO_STATUS_SUCCESS)
+            {
+                throw std::runtime_error(std::string("Cairo surface error: ") +
+                    cairo_status_to_string(cairo_surface_status(&*image_surface)));
+            }
+        }
+        output.close();
+        return output;
     }
 };
 
@@ -168,6 +436,8 @@ struct cairo_svg_renderer : cairo_vector_renderer<cairo_svg_surface_create_for_s
 {
     static constexpr const char * name = "cairo-svg";
     static constexpr const char * ext = ".svg";
+
+    using cairo_vector_renderer::cairo_vector_renderer;
 };
 #endif
 
@@ -176,6 +446,8 @@ struct cairo_ps_renderer : cairo_vector_renderer<cairo_ps_surface_create_for_str
 {
     static constexpr const char * name = "cairo-ps";
     static constexpr const char * ext = ".ps";
+
+    using cairo_vector_renderer::cairo_vector_renderer;
 };
 #endif
 
@@ -184,23 +456,39 @@ struct cairo_pdf_renderer : cairo_vector_renderer<cairo_pdf_surface_create_for_s
 {
     static constexpr const char * name = "cairo-pdf";
     static constexpr const char * ext = ".pdf";
+
+    using cairo_vector_renderer::cairo_vector_renderer;
 };
 #endif
 #endif
 
 #if defined(SVG_RENDERER)
-struct svg_renderer : vector_renderer_base
+struct svg_renderer : spooled_renderer_base
 {
     static constexpr const char * name = "svg";
     static constexpr const char * ext = ".svg";
 
+    using spooled_renderer_base::spooled_renderer_base;
+
+    // libmapnik instantiates svg_renderer for std::ostream_iterator<char>
+    // only, so characters go through an ostream. Its buffer hands them to
+    // the spool file in 64 KiB blocks.
     image_type render(mapnik::Map const & map, double scale_factor) const
     {
-        std::stringstream ss;
-        std::ostream_iterator<char> output_stream_iterator(ss);
-        mapnik::svg_renderer<std::ostream_iterator<char>> ren(map, output_stream_iterator, scale_factor);
-        ren.apply();
-        return ss.str();
+        image_type output(spool());
+        {
+            spool_streambuf buffer(output);
+            std::ostream stream(&buffer);
+            std::ostream_iterator<char> output_stream_iterator(stream);
+            mapnik::svg_renderer<std::ostream_iterator<char>> ren(map, output_stream_iterator, scale_factor);
+            ren.apply();
+            if (!stream.flush())
+            {
+                throw std::runtime_error("Could not write SVG output");
+            }
+        }
+        output.close();
+        return output;
     }
 };
 #endif
@@ -210,35 +498,17 @@ struct grid_renderer : raster_renderer_base<mapnik::image_rgba8>
 {
     static constexpr const char * name = "grid";
 
+    using raster_renderer_base::raster_renderer_base;
+
     void convert(mapnik::grid::data_type const & grid, image_type & image) const
     {
+        using id_type = mapnik::grid::value_type;
+        static_assert(std::is_same<id_type, std::int64_t>::value ||
+                      std::is_same<id_type, std::int32_t>::value,
+                      "grid renderer: mapnik::grid::value_type must be a 32 or 64 bit signed integer.");
         for (std::size_t y = 0; y < grid.height(); ++y)
         {
-            mapnik::grid::value_type const * grid_row = grid.get_row(y);
-            image_type::pixel_type * image_row = image.get_row(y);
-            for (std::size_t x = 0; x < grid.width(); ++x)
-            {
-                mapnik::grid::value_type val = grid_row[x];
-
-                if (val == mapnik::grid::base_mask)
-                {
-                    image_row[x] = 0;
-                    continue;
-                }
-                if (val < 0)
-                {
-                    throw std::runtime_error("grid renderer: feature id is negative.");
-                }
-
-                val *= 100;
-
-                if (val > 0x00ffffff)
-                {
-                    throw std::runtime_error("grid renderer: feature id is too high.");
-                }
-
-                image_row[x] = val | 0xff000000;
-            }
+            convert_grid_ids(grid.get_row(y), image.get_row(y), grid.width(), mapnik::grid::base_mask);
         }
     }
 
@@ -247,13 +517,84 @@ struct grid_renderer : raster_renderer_base<mapnik::image_rgba8>
         mapnik::grid grid(map.width(), map.height(), "__id__");
         mapnik::grid_renderer<mapnik::grid> ren(map, grid, scale_factor);
         ren.apply();
-        image_type image(map.width(), map.height());
+        image_type image(create(map.width(), map.height()));
         convert(grid.data(), image);
         return image;
     }
 };
+
+// Renders grid and encodes it as UTFGrid JSON when saved, so encode phase
+// tells the encoding cost apart from rendering.
+struct utfgrid_renderer
+{
+    using image_type = std::unique_ptr<mapnik::grid>;
+
+    static constexpr const char * name = "utfgrid";
+    static constexpr const char * ext = ".json";
+    static constexpr const bool support_tiles = false;
+    static constexpr const bool compare_encoded = true;
+
+    explicit utfgrid_renderer(renderer_options const & options)
+        : resolution(options.grid_resolution),
+          fields(options.grid_fields)
+    {
+    }
+
+    image_type render(mapnik::Map const & map, double scale_factor) const
+    {
+        image_type grid(new mapnik::grid(map.width(), map.height(), "__id__"));
+        for (auto const & field : fields)
+        {
+            grid->add_field(field);
+        }
+        mapnik::grid_renderer<mapnik::grid> ren(map, *grid, scale_factor);
+        ren.apply();
+        return grid;
+    }
+
+    std::string encode(image_type const & grid) const
+    {
+        return encode_utfgrid(*grid, resolution, fields);
+    }
+
+    std::pair<void const *, std::size_t> raw(image_type const & grid) const
+    {
+        return std::make_pair(static_cast<void const *>(grid->data().bytes()), grid->data().size());
+    }
+
+    std::size_t compare(std::string const & encoded, boost::filesystem::path const& reference, unsigned) const
+    {
+        return compare_bytes(encoded, reference);
+    }
+
+    void recycle(image_type &&) const
+    {
+    }
+
+    const unsigned resolution;
+    const std::vector<std::string> fields;
+};
 #endif
 
+// Copies rows of width pixels, as one block when both images are exactly
+// that wide and rows follow each other without gaps.
+template <typename T>
+void copy_rows(typename T::pixel_type const * from, std::size_t from_width,
+               typename T::pixel_type * to, std::size_t to_width,
+               std::size_t width, std::size_t rows)
+{
+    if (width == from_width && width == to_width)
+    {
+        std::memcpy(to, from, rows * width * sizeof(typename T::pixel_type));
+        return;
+    }
+
+    for (std::size_t row = 0; row < rows; ++row)
+    {
+        std::memcpy(to + row * to_width, from + row * from_width, width * sizeof(typename T::pixel_type));
+    }
+}
+
 template <typename T>
 void set_rectangle(T const & src, T & dst, std::size_t x, std::size_t y)
 {
@@ -263,16 +604,25 @@ void set_rectangle(T const & src, T & dst, std::size_t x, std::size_t y)
     if (ext0.intersects(ext1))
     {
         mapnik::box2d<int> box = ext0.intersect(ext1);
-        for (std::size_t pix_y = box.miny(); pix_y < static_cast<std::size_t>(box.maxy()); ++pix_y)
-        {
-            typename T::pixel_type * row_to =  dst.get_row(pix_y);
-            typename T::pixel_type const * row_from = src.get_row(pix_y - y);
+        copy_rows<T>(src.get_row(box.miny() - y) + (box.minx() - x), src.width(),
+                     dst.get_row(box.miny()) + box.minx(), dst.width(),
+                     box.width(), box.height());
+    }
+}
 
-            for (std::size_t pix_x = box.minx(); pix_x < static_cast<std::size_t>(box.maxx()); ++pix_x)
-            {
-                row_to[pix_x] = row_from[pix_x - x];
-            }
-        }
+// Inverse of set_rectangle, fills dst with area of src starting at x, y.
+template <typename T>
+void get_rectangle(T const & src, T & dst, std::size_t x, std::size_t y)
+{
+    mapnik::box2d<int> ext0(0, 0, src.width(), src.height());
+    mapnik::box2d<int> ext1(x, y, x + dst.width(), y + dst.height());
+
+    if (ext0.intersects(ext1))
+    {
+        mapnik::box2d<int> box = ext0.intersect(ext1);
+        copy_rows<T>(src.get_row(box.miny()) + box.minx(), src.width(),
+                     dst.get_row(box.miny() - y) + (box.minx() - x), dst.width(),
+                     box.width(), box.height());
     }
 }
 
@@ -283,8 +633,8 @@ public:
     using renderer_type = Renderer;
     using image_type = typename Renderer::image_type;
 
-    renderer(boost::filesystem::path const & _output_dir)
-        : ren(), output_dir(_output_dir)
+    renderer(renderer_options const & _options)
+        : ren(_options), options(_options)
     {
     }
 
@@ -293,32 +643,108 @@ public:
         return ren.render(map, scale_factor);
     }
 
-    image_type render(mapnik::Map & map, double scale_factor, map_size const & tiles) const
+    Renderer const & get() const
+    {
+        return ren;
+    }
+
+    // Whether some of the rendering runs on other than the calling thread.
+    bool off_thread(mapnik::Map const & map, map_size const & tiles) const
+    {
+        return (options.tile_pool && (tiles.width > 1 || tiles.height > 1)) ||
+            renders_in_parallel(ren, map);
+    }
+
+    // Whether tiles of the job are rendered also one by one in tile
+    // comparison mode, returns number of tile threads or zero.
+    std::size_t tile_compare_threads(map_size const & tiles) const
+    {
+        if (!Renderer::support_tiles || !options.tile_compare || !options.tile_pool ||
+            (tiles.width == 1 && tiles.height == 1))
+        {
+            return 0;
+        }
+        return options.tile_pool->size();
+    }
+
+    // Blank raster image, taken from pool if there is one.
+    image_type create(std::size_t width, std::size_t height) const
+    {
+        return ren.create(width, height);
+    }
+
+    // Image of a render nobody needs any more, its buffer may be reused.
+    void recycle(image_type && image) const
+    {
+        ren.recycle(std::move(image));
+    }
+
+    // Renders tiles on tile pool, if set. The sum of tile render times is
+    // added to tiles_duration.
+    image_type render(mapnik::Map & map,
+                      double scale_factor,
+                      map_size const & tiles,
+                      std::chrono::high_resolution_clock::duration & tiles_duration) const
+    {
+        return render(map, scale_factor, tiles, tiles_duration, options.tile_pool.get());
+    }
+
+    // Renders tiles one by one into the shared map, or concurrently on a copy
+    // of the map per tile when pool is given.
+    image_type render(mapnik::Map & map,
+                      double scale_factor,
+                      map_size const & tiles,
+                      std::chrono::high_resolution_clock::duration & tiles_duration,
+                      thread_pool * pool) const
     {
         mapnik::box2d<double> box = map.get_current_extent();
-        image_type image(map.width(), map.height());
-        map.resize(image.width() / tiles.width, image.height() / tiles.height);
-        double tile_box_width = box.width() / tiles.width;
-        double tile_box_height = box.height() / tiles.height;
-        for (std::size_t tile_y = 0; tile_y < tiles.height; tile_y++)
+        image_type image(ren.create(map.width(), map.height()));
+        map_size tile_size(image.width() / tiles.width, image.height() / tiles.height);
+
+        if (pool)
         {
-            for (std::size_t tile_x = 0; tile_x < tiles.width; tile_x++)
+            std::vector<std::chrono::high_resolution_clock::duration> durations(tiles.width * tiles.height);
+            task_group group(*pool);
+            memory_counters * counters = memory_scope::current();
+            std::shared_ptr<trace_context const> trace(trace_scope::current());
+            for (std::size_t tile_y = 0; tile_y < tiles.height; tile_y++)
             {
-                mapnik::box2d<double> tile_box(
-                    box.minx() + tile_x * tile_box_width,
-                    box.miny() + tile_y * tile_box_height,
-                    box.minx() + (tile_x + 1) * tile_box_width,
-                    box.miny() + (tile_y + 1) * tile_box_height);
-                map.zoom_to_box(tile_box);
-                image_type tile(ren.render(map, scale_factor));
-                set_rectangle(tile, image, tile_x * tile.width(), (tiles.height - 1 - tile_y) * tile.height());
+                for (std::size_t tile_x = 0; tile_x < tiles.width; tile_x++)
+                {
+                    group.run([&, tile_x, tile_y](std::size_t)
+                    {
+                        memory_scope scope(counters);
+                        trace_scope trace_context_scope(trace);
+                        mapnik::Map tile_map(map);
+                        tile_map.resize(tile_size.width, tile_size.height);
+                        durations[tile_y * tiles.width + tile_x] =
+                            render_tile(tile_map, scale_factor, box, tiles, tile_x, tile_y, image);
+                    });
+                }
+            }
+            group.wait();
+            for (auto const & duration : durations)
+            {
+                tiles_duration += duration;
             }
         }
+        else
+        {
+            map.resize(tile_size.width, tile_size.height);
+            for (std::size_t tile_y = 0; tile_y < tiles.height; tile_y++)
+            {
+                for (std::size_t tile_x = 0; tile_x < tiles.width; tile_x++)
+                {
+                    tiles_duration += render_tile(map, scale_factor, box, tiles, tile_x, tile_y, image);
+                }
+            }
+            map.resize(image.width(), image.height());
+            map.zoom_to_box(box);
+        }
         return image;
     }
 
-    result report(image_type const & image,
-                  std::string const & name,
+    result report(std::string const & name,
                   map_size const & size,
                   map_size const & tiles,
                   double scale_factor,
@@ -332,16 +758,135 @@ public:
         res.scale_factor = scale_factor;
         res.size = size;
         res.tiles = tiles;
+        res.image_path = options.output_dir / image_file_name(name, size, tiles, scale_factor, box);
 
-        boost::filesystem::create_directories(output_dir);
-        boost::filesystem::path path = output_dir / image_file_name(name, size, tiles, scale_factor, box);
-        res.image_path = path;
-        ren.save(image, path);
+        return res;
+    }
+
+    // Image encoded the way sinks store it.
+    std::string encode(image_type const & image) const
+    {
+        return ren.encode(image);
+    }
+
+    // Result of one tile of a seeded pyramid saved as output_dir/name/z/x/y.ext.
+    result tile_report(std::string const & name,
+                       unsigned zoom,
+                       std::size_t x,
+                       std::size_t y,
+                       map_size const & size,
+                       double scale_factor) const
+    {
+        result res;
+
+        res.state = STATE_OK;
+        res.name = name;
+        res.renderer_name = Renderer::name;
+        res.scale_factor = scale_factor;
+        res.size = size;
+        res.tiles = map_size(1, 1);
+        res.image_path = options.output_dir / name / std::to_string(zoom) / std::to_string(x) /
+            (std::to_string(y) + Renderer::ext);
 
         return res;
     }
 
+    // Saves image to res.image_path. With a writer the image is moved to
+    // the background stage, which records write phases and errors into res
+    // later, so res must stay in place until writer is drained.
+    void save(image_type && image, result & res) const
+    {
+        if (options.writer)
+        {
+            std::shared_ptr<image_type> owned(std::make_shared<image_type>(std::move(image)));
+            result * slot = &res;
+            std::shared_ptr<trace_context const> trace(trace_scope::current());
+            options.writer->write([this, owned, slot, trace]()
+            {
+                trace_scope scope(trace);
+                try
+                {
+                    save(*owned, *slot);
+                    ren.recycle(std::move(*owned));
+                }
+                catch (std::exception const& ex)
+                {
+                    slot->state = STATE_ERROR;
+                    slot->error_message = ex.what();
+                }
+            });
+        }
+        else
+        {
+            save(image, res);
+            ren.recycle(std::move(image));
+        }
+    }
+
 private:
+    void save(image_type const & image, result & res) const
+    {
+        save(image, res, compares_encoded<Renderer>());
+    }
+
+    void save(image_type const & image, result & res, std::false_type) const
+    {
+        if (options.reference_dir)
+        {
+            compare(image, res);
+        }
+        mapnik::util::apply_visitor(save_visitor<Renderer>(ren, image, res), options.sink);
+    }
+
+    void save(image_type const & image, result & res, std::true_type) const
+    {
+        boost::optional<std::string> encoded;
+        if (options.reference_dir)
+        {
+            trace_span span("encode");
+            std::chrono::high_resolution_clock::time_point start(std::chrono::high_resolution_clock::now());
+            encoded = ren.encode(image);
+            res.phases.encode += std::chrono::high_resolution_clock::now() - start;
+            compare(*encoded, res);
+        }
+        mapnik::util::apply_visitor(save_visitor<Renderer>(ren, image, res, encoded.get_ptr()), options.sink);
+    }
+
+    template <typename Actual>
+    void compare(Actual const & actual, result & res) const
+    {
+        boost::filesystem::path reference = *options.reference_dir / res.image_path.filename();
+        res.mismatched_pixels = ren.compare(actual, reference, options.tolerance);
+        if (*res.mismatched_pixels > 0)
+        {
+            res.state = STATE_FAIL;
+        }
+    }
+
+    std::chrono::high_resolution_clock::duration render_tile(mapnik::Map & map,
+                                                              double scale_factor,
+                                                              mapnik::box2d<double> const & box,
+                                                              map_size const & tiles,
+                                                              std::size_t tile_x,
+                                                              std::size_t tile_y,
+                                                              image_type & image) const
+    {
+        trace_span span("render_tile");
+        std::chrono::high_resolution_clock::time_point start(std::chrono::high_resolution_clock::now());
+        double tile_box_width = box.width() / tiles.width;
+        double tile_box_height = box.height() / tiles.height;
+        mapnik::box2d<double> tile_box(
+            box.minx() + tile_x * tile_box_width,
+            box.miny() + tile_y * tile_box_height,
+            box.minx() + (tile_x + 1) * tile_box_width,
+            box.miny() + (tile_y + 1) * tile_box_height);
+        map.zoom_to_box(tile_box);
+        image_type tile(ren.render(map, scale_factor));
+        set_rectangle(tile, image, tile_x * tile.width(), (tiles.height - 1 - tile_y) * tile.height());
+        ren.recycle(std::move(tile));
+        return std::chrono::high_resolution_clock::now() - start;
+    }
+
     std::string image_file_name(std::string const & test_name,
                                 map_size const & size,
                                 map_size const & tiles,
@@ -363,7 +908,7 @@ private:
     }
 
     const Renderer ren;
-    const boost::filesystem::path output_dir;
+    const renderer_options options;
 };
 
 using renderer_type = mapnik::util::variant<renderer<agg_renderer>
@@ -384,6 +929,7 @@ using renderer_type = mapnik::util::variant<renderer<agg_renderer>
 #endif
 #if defined(GRID_RENDERER)
                                             ,renderer<grid_renderer>
+                                            ,renderer<utfgrid_renderer>
 #endif
                                             >;
 
@@ -24,12 +24,188 @@
 #include <fstream>
 #include <numeric>
 #include <map>
+#include <thread>
+#include <ctime>
+#include <sstream>
+
+#include <unistd.h>
+
+#include <mapnik/version.hpp>
 
 #include "report.hpp"
 
 namespace mapnik_render
 {
 
+namespace
+{
+
+unsigned failed_count(result_list const & results)
+{
+    unsigned failed = 0;
+    for (auto const & r : results)
+    {
+        if (r.state != STATE_OK)
+        {
+            failed++;
+        }
+    }
+    return failed;
+}
+
+std::string csv_field(std::string const & str)
+{
+    if (str.find_first_of(",\"\n\r") == std::string::npos)
+    {
+        return str;
+    }
+    std::string quoted("\"");
+    for (char c : str)
+    {
+        if (c == '"')
+        {
+            quoted += '"';
+        }
+        quoted += c;
+    }
+    return quoted + '"';
+}
+
+std::string hex(std::uint64_t value)
+{
+    std::ostringstream s;
+    s << std::hex << std::setw(16) << std::setfill('0') << value;
+    return s.str();
+}
+
+long long nanoseconds(duration_type const & d)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+}
+
+std::string optional_count(boost::optional<std::uint64_t> const & count)
+{
+    return count ? std::to_string(*count) : "n/a";
+}
+
+std::string optional_json(boost::optional<std::uint64_t> const & count)
+{
+    return count ? std::to_string(*count) : "null";
+}
+
+double mebibytes(std::uint64_t bytes)
+{
+    return bytes / (1024.0 * 1024.0);
+}
+
+void write_changes(std::ostream & o, char const * key, std::vector<baseline_change> const & changes)
+{
+    o << "    \"" << key << "\": [";
+    for (std::size_t i = 0; i < changes.size(); i++)
+    {
+        baseline_change const & change = changes[i];
+        o << (i ? ",\n" : "\n")
+          << "      {"
+          << " \"name\": " << json_string(change.name)
+          << ", \"renderer\": " << json_string(change.renderer_name)
+          << ", \"configuration\": " << json_string(change.configuration)
+          << ", \"baseline_median_ns\": " << nanoseconds(change.baseline_median)
+          << ", \"median_ns\": " << nanoseconds(change.median)
+          << ", \"p_value\": " << std::setprecision(6) << change.p_value
+          << ", \"regression\": " << (change.regression ? "true" : "false") << " }";
+    }
+    o << (changes.empty() ? "]" : "\n    ]");
+}
+
+}
+
+std::string envelope_string(mapnik::box2d<double> const & box)
+{
+    std::ostringstream s;
+    s << std::setprecision(17) << box.minx() << ',' << box.miny() << ',' << box.maxx() << ',' << box.maxy();
+    return s.str();
+}
+
+std::string json_string(std::string const & str)
+{
+    std::ostringstream s;
+    s << '"';
+    for (char c : str)
+    {
+        switch (c)
+        {
+            case '"': s << "\\\""; break;
+            case '\\': s << "\\\\"; break;
+            case '\n': s << "\\n"; break;
+            case '\r': s << "\\r"; break;
+            case '\t': s << "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20)
+                {
+                    s << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+                      << static_cast<int>(c) << std::dec << std::setfill(' ');
+                }
+                else
+                {
+                    s << c;
+                }
+        }
+    }
+    s << '"';
+    return s.str();
+}
+
+char const * state_name(result_state state)
+{
+    switch (state)
+    {
+        case STATE_OK: return "ok";
+        case STATE_FAIL: return "fail";
+        case STATE_ERROR: return "error";
+    }
+    return "unknown";
+}
+
+run_metadata run_metadata::collect(std::size_t jobs)
+{
+    run_metadata metadata;
+
+    char host[256] = {};
+    if (gethostname(host, sizeof(host) - 1) == 0)
+    {
+        metadata.host = host;
+    }
+
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line))
+    {
+        if (line.compare(0, 10, "model name") == 0)
+        {
+            std::size_t colon = line.find(':');
+            if (colon != std::string::npos)
+            {
+                metadata.cpu_model = line.substr(line.find_first_not_of(' ', colon + 1));
+            }
+            break;
+        }
+    }
+
+    metadata.hardware_threads = std::thread::hardware_concurrency();
+    metadata.jobs = jobs;
+    metadata.mapnik_version = MAPNIK_VERSION_STRING;
+
+    std::time_t now = std::time(nullptr);
+    std::tm utc;
+    char time[32] = {};
+    if (gmtime_r(&now, &utc) && std::strftime(time, sizeof(time), "%Y-%m-%dT%H:%M:%SZ", &utc))
+    {
+        metadata.start_time = time;
+    }
+
+    return metadata;
+}
+
 void console_report::report(result const & r)
 {
     s << '"' << r.name << '-' << r.size.width << '-' << r.size.height;
@@ -43,67 +219,251 @@ void console_report::report(result const & r)
     {
         case STATE_OK:
             s << "OK";
+            if (r.checksum)
+            {
+                s << " [" << std::hex << std::setfill('0') << std::setw(16) << *r.checksum
+                  << std::dec << std::setfill(' ') << "]";
+            }
+            break;
+        case STATE_FAIL:
+            s << "FAILED (" << *r.mismatched_pixels << " different pixels)";
             break;
         case STATE_ERROR:
             s << "ERROR (" << r.error_message << ")";
             break;
     }
 
+    if (r.cached)
+    {
+        s << " (cached)";
+    }
+
     if (show_duration)
     {
-        s << " (" << std::chrono::duration_cast<std::chrono::milliseconds>(r.duration).count() << " milliseconds)";
+        s << " (" << std::chrono::duration_cast<std::chrono::milliseconds>(r.duration).count() << " milliseconds";
+        if (r.samples.size() > 1)
+        {
+            duration_statistics const & stats = r.statistics;
+            s << std::setprecision(3)
+              << ", min " << to_milliseconds(stats.min)
+              << " / median " << to_milliseconds(stats.median)
+              << " / mean " << to_milliseconds(stats.mean)
+              << " / p95 " << to_milliseconds(stats.p95)
+              << " / p99 " << to_milliseconds(stats.p99)
+              << " / stddev " << to_milliseconds(stats.stddev) << " ms";
+        }
+        if ((r.tiles.width > 1 || r.tiles.height > 1) && r.duration.count() > 0 && r.tiles_duration.count() > 0)
+        {
+            // Average number of tiles rendering at once, not a comparison
+            // with serial rendering.
+            s << ", tile concurrency " << std::setprecision(2)
+              << static_cast<double>(r.tiles_duration.count()) / r.duration.count() << "x";
+        }
+        s << ")";
+
+        phase_durations const & phases = r.phases;
+        s << std::endl << "    " << std::setprecision(3)
+          << "load_map " << to_milliseconds(phases.load_map)
+          << " / zoom " << to_milliseconds(phases.zoom)
+          << " / render " << to_milliseconds(phases.render)
+          << " / encode " << to_milliseconds(phases.encode)
+          << " / write " << to_milliseconds(phases.write) << " ms";
+    }
+
+    if (r.memory)
+    {
+        memory_usage const & memory = *r.memory;
+        s << std::endl << "    " << std::setprecision(1)
+          << memory.allocations << " allocations / "
+          << mebibytes(memory.bytes) << " MiB allocated / "
+          << mebibytes(memory.peak_heap) << " MiB peak heap / rss "
+          << mebibytes(memory.rss) << " MiB (peak " << mebibytes(memory.peak_rss) << " MiB)";
+    }
+
+    if (r.cpu)
+    {
+        cpu_usage const & cpu = *r.cpu;
+        s << std::endl << "    " << std::setprecision(3)
+          << "cpu " << to_milliseconds(cpu.cpu_time)
+          << " (user " << to_milliseconds(cpu.user_time)
+          << " / system " << to_milliseconds(cpu.system_time) << ") ms, "
+          << cpu.voluntary_switches << " voluntary / "
+          << cpu.involuntary_switches << " involuntary context switches";
+        if (cpu.cycles && cpu.instructions)
+        {
+            s << std::endl << "    "
+              << *cpu.cycles << " cycles / "
+              << *cpu.instructions << " instructions";
+            if (*cpu.cycles > 0)
+            {
+                s << " (" << std::setprecision(2)
+                  << static_cast<double>(*cpu.instructions) / *cpu.cycles << " IPC)";
+            }
+        }
+        if (cpu.cache_misses || cpu.branch_misses)
+        {
+            s << std::endl << "    "
+              << optional_count(cpu.cache_misses) << " LLC misses / "
+              << optional_count(cpu.branch_misses) << " branch misses";
+        }
+    }
+
+    if (r.parallelizer)
+    {
+        parallelizer_comparison const & parallelizer = *r.parallelizer;
+        s << std::endl << "    " << std::setprecision(3)
+          << "parallelizer " << to_milliseconds(parallelizer.parallel)
+          << " / serial " << to_milliseconds(parallelizer.serial) << " ms, "
+          << std::setprecision(2) << parallelizer.speedup << "x speedup, "
+          << std::setprecision(0) << parallelizer.efficiency * 100 << "% efficiency on "
+          << parallelizer.threads << " threads, "
+          << parallelizer.mismatched_pixels << " different pixels";
+    }
+
+    if (r.tile_pool)
+    {
+        tile_comparison const & tile_pool = *r.tile_pool;
+        s << std::endl << "    " << std::setprecision(3)
+          << "tiles concurrent " << to_milliseconds(tile_pool.concurrent)
+          << " / serial " << to_milliseconds(tile_pool.serial) << " ms, "
+          << std::setprecision(2) << tile_pool.speedup << "x speedup on "
+          << tile_pool.threads << " tile threads";
     }
 
     s << std::endl;
 }
 
-unsigned console_report::summary(result_list const & results)
+unsigned console_report::summary(result_list const & results, run_summary const & run)
 {
     unsigned ok = 0;
+    unsigned fail = 0;
     unsigned error = 0;
 
     using namespace std::chrono;
-    using duration_map_type = std::map<std::string, high_resolution_clock::duration>;
+
+    struct renderer_durations
+    {
+        high_resolution_clock::duration total = high_resolution_clock::duration::zero();
+        high_resolution_clock::duration median = high_resolution_clock::duration::zero();
+        high_resolution_clock::duration p95 = high_resolution_clock::duration::zero();
+        double cv_sum = 0;
+        std::size_t count = 0;
+    };
+
+    using duration_map_type = std::map<std::string, renderer_durations>;
     duration_map_type durations;
+    phase_durations phases;
+    result const * largest_heap = nullptr;
 
     for (auto const & r : results)
     {
         switch (r.state)
         {
             case STATE_OK: ok++; break;
+            case STATE_FAIL: fail++; break;
             case STATE_ERROR: error++; break;
         }
 
+        if (r.memory && (!largest_heap || r.memory->peak_heap > largest_heap->memory->peak_heap))
+        {
+            largest_heap = &r;
+        }
+
         if (show_duration)
         {
-            duration_map_type::iterator duration = durations.find(r.renderer_name);
-            if (duration == durations.end())
-            {
-                durations.emplace(r.renderer_name, r.duration);
-            }
-            else
+            renderer_durations & duration = durations[r.renderer_name];
+            duration.total += r.duration;
+            duration.median += r.statistics.median;
+            duration.p95 += r.statistics.p95;
+            if (r.statistics.mean.count() > 0)
             {
-                duration->second += r.duration;
+                duration.cv_sum += static_cast<double>(r.statistics.stddev.count()) / r.statistics.mean.count();
             }
+            duration.count++;
+
+            phases.load_map += r.phases.load_map;
+            phases.zoom += r.phases.zoom;
+            phases.render += r.phases.render;
+            phases.encode += r.phases.encode;
+            phases.write += r.phases.write;
         }
     }
 
     s << std::endl;
-    s << "Rendering: " << ok << " ok / " << error << " errors" << std::endl;
+    s << "Rendering: " << ok << " ok / " << fail << " failed / " << error << " errors" << std::endl;
+
+    if (largest_heap)
+    {
+        s << "Largest peak heap: " << largest_heap->image_path.filename().string() << " "
+          << std::fixed << std::setprecision(1) << mebibytes(largest_heap->memory->peak_heap) << " MiB" << std::endl;
+    }
 
     if (show_duration)
     {
         high_resolution_clock::duration total(0);
         for (auto const & duration : durations)
         {
-            s << duration.first << ": \t" << duration_cast<milliseconds>(duration.second).count()
-              << " milliseconds" << std::endl;
-            total += duration.second;
+            s << duration.first << ": \t" << duration_cast<milliseconds>(duration.second.total).count()
+              << " milliseconds (sum of medians " << std::fixed << std::setprecision(3)
+              << to_milliseconds(duration.second.median)
+              << " ms, sum of p95 " << to_milliseconds(duration.second.p95)
+              << " ms, mean cv " << std::setprecision(1)
+              << 100.0 * duration.second.cv_sum / duration.second.count << "%)" << std::endl;
+            total += duration.second.total;
         }
         s << "total: \t" << duration_cast<milliseconds>(total).count() << " milliseconds" << std::endl;
+        s << "phases: \tload_map " << duration_cast<milliseconds>(phases.load_map).count()
+          << " / zoom " << duration_cast<milliseconds>(phases.zoom).count()
+          << " / render " << duration_cast<milliseconds>(phases.render).count()
+          << " / encode " << duration_cast<milliseconds>(phases.encode).count()
+          << " / write " << duration_cast<milliseconds>(phases.write).count() << " milliseconds" << std::endl;
+    }
+
+    if (run.image_pool)
+    {
+        s << "Image pool: " << run.image_pool->hits << " hits / " << run.image_pool->misses << " misses" << std::endl;
     }
 
-    return error;
+    if (run.comparison)
+    {
+        s << "Baseline: " << run.comparison->matched << " matched / " << run.comparison->unmatched << " not found / "
+          << run.comparison->inconclusive << " inconclusive / "
+          << run.comparison->slower.size() << " slower / " << run.comparison->faster.size() << " faster / "
+          << run.comparison->regressions << " regressions" << std::endl;
+        if (run.comparison->inconclusive)
+        {
+            s << "Warning: " << run.comparison->inconclusive
+              << " configurations have too few samples to be compared at significance "
+              << run.comparison->significance;
+            if (run.comparison->samples_needed)
+            {
+                s << ", at least " << run.comparison->samples_needed << " iterations on both sides are needed";
+            }
+            s << ", comparison could not decide." << std::endl;
+        }
+        for (auto const & change : run.comparison->slower)
+        {
+            print_change(change, "slower");
+        }
+        for (auto const & change : run.comparison->faster)
+        {
+            print_change(change, "faster");
+        }
+        return fail + error + run.comparison->regressions;
+    }
+
+    return fail + error;
+}
+
+void console_report::print_change(baseline_change const & change, char const * direction)
+{
+    double baseline_ms = to_milliseconds(change.baseline_median);
+    double ms = to_milliseconds(change.median);
+    s << direction << ": \t" << change.configuration << " "
+      << std::fixed << std::setprecision(3) << baseline_ms << " -> " << ms << " ms ("
+      << std::showpos << std::setprecision(1) << (baseline_ms > 0 ? 100.0 * (ms - baseline_ms) / baseline_ms : 0.0)
+      << std::noshowpos << "%, p " << std::setprecision(4) << change.p_value << ")"
+      << (change.regression ? " REGRESSION" : "") << std::endl;
 }
 
 void console_short_report::report(result const & r)
@@ -113,10 +473,254 @@ void console_short_report::report(result const & r)
         case STATE_OK:
             s << ".";
             break;
+        case STATE_FAIL:
+            s << "✘";
+            break;
         case STATE_ERROR:
             s << "ERROR (" << r.error_message << ")\n";
             break;
     }
 }
 
+unsigned json_report::summary(result_list const & results, run_summary const & run)
+{
+    std::ostream & o = *s;
+
+    o << "{\n"
+      << "  \"metadata\": {\n"
+      << "    \"host\": " << json_string(metadata.host) << ",\n"
+      << "    \"cpu_model\": " << json_string(metadata.cpu_model) << ",\n"
+      << "    \"hardware_threads\": " << metadata.hardware_threads << ",\n"
+      << "    \"jobs\": " << metadata.jobs << ",\n"
+      << "    \"mapnik_version\": " << json_string(metadata.mapnik_version) << ",\n"
+      << "    \"start_time\": " << json_string(metadata.start_time) << "\n"
+      << "  },\n"
+      << "  \"results\": [";
+
+    for (std::size_t i = 0; i < results.size(); i++)
+    {
+        result const & r = results[i];
+        duration_statistics const & stats = r.statistics;
+        phase_durations const & phases = r.phases;
+
+        o << (i ? ",\n" : "\n")
+          << "    {\n"
+          << "      \"name\": " << json_string(r.name) << ",\n"
+          << "      \"state\": \"" << state_name(r.state) << "\",\n"
+          << "      \"renderer\": " << json_string(r.renderer_name) << ",\n"
+          << "      \"width\": " << r.size.width << ",\n"
+          << "      \"height\": " << r.size.height << ",\n"
+          << "      \"tiles_x\": " << r.tiles.width << ",\n"
+          << "      \"tiles_y\": " << r.tiles.height << ",\n"
+          << "      \"scale_factor\": " << std::setprecision(17) << r.scale_factor << ",\n"
+          << "      \"envelope\": " << (r.envelope ? json_string(envelope_string(*r.envelope)) : "null") << ",\n"
+          << "      \"image_path\": " << json_string(r.image_path.string()) << ",\n"
+          << "      \"error\": " << json_string(r.error_message) << ",\n"
+          << "      \"duration_ns\": " << nanoseconds(r.duration) << ",\n"
+          << "      \"samples_ns\": [";
+        for (std::size_t j = 0; j < r.samples.size(); j++)
+        {
+            o << (j ? ", " : "") << nanoseconds(r.samples[j]);
+        }
+        o << "],\n"
+          << "      \"statistics_ns\": {"
+          << " \"min\": " << nanoseconds(stats.min)
+          << ", \"max\": " << nanoseconds(stats.max)
+          << ", \"median\": " << nanoseconds(stats.median)
+          << ", \"mean\": " << nanoseconds(stats.mean)
+          << ", \"p95\": " << nanoseconds(stats.p95)
+          << ", \"p99\": " << nanoseconds(stats.p99)
+          << ", \"stddev\": " << nanoseconds(stats.stddev) << " },\n"
+          << "      \"tiles_duration_ns\": " << nanoseconds(r.tiles_duration) << ",\n"
+          << "      \"phases_ns\": {"
+          << " \"load_map\": " << nanoseconds(phases.load_map)
+          << ", \"zoom\": " << nanoseconds(phases.zoom)
+          << ", \"render\": " << nanoseconds(phases.render)
+          << ", \"encode\": " << nanoseconds(phases.encode)
+          << ", \"write\": " << nanoseconds(phases.write) << " },\n"
+          << "      \"checksum\": " << (r.checksum ? json_string(hex(*r.checksum)) : "null") << ",\n"
+          << "      \"mismatched_pixels\": " << (r.mismatched_pixels ? std::to_string(*r.mismatched_pixels) : "null") << ",\n"
+          << "      \"cached\": " << (r.cached ? "true" : "false") << ",\n"
+          << "      \"memory\": ";
+        if (r.memory)
+        {
+            o << "{"
+              << " \"allocations\": " << r.memory->allocations
+              << ", \"bytes\": " << r.memory->bytes
+              << ", \"peak_heap\": " << r.memory->peak_heap
+              << ", \"rss\": " << r.memory->rss
+              << ", \"peak_rss\": " << r.memory->peak_rss << " }";
+        }
+        else
+        {
+            o << "null";
+        }
+        o << ",\n"
+          << "      \"cpu\": ";
+        if (r.cpu)
+        {
+            o << "{"
+              << " \"cycles\": " << optional_json(r.cpu->cycles)
+              << ", \"instructions\": " << optional_json(r.cpu->instructions)
+              << ", \"cache_misses\": " << optional_json(r.cpu->cache_misses)
+              << ", \"branch_misses\": " << optional_json(r.cpu->branch_misses)
+              << ", \"cpu_time_ns\": " << nanoseconds(r.cpu->cpu_time)
+              << ", \"user_time_ns\": " << nanoseconds(r.cpu->user_time)
+              << ", \"system_time_ns\": " << nanoseconds(r.cpu->system_time)
+              << ", \"voluntary_switches\": " << r.cpu->voluntary_switches
+              << ", \"involuntary_switches\": " << r.cpu->involuntary_switches << " }";
+        }
+        else
+        {
+            o << "null";
+        }
+        o << ",\n"
+          << "      \"parallelizer\": ";
+        if (r.parallelizer)
+        {
+            o << "{"
+              << " \"serial_ns\": " << nanoseconds(r.parallelizer->serial)
+              << ", \"parallel_ns\": " << nanoseconds(r.parallelizer->parallel)
+              << ", \"threads\": " << r.parallelizer->threads
+              << ", \"speedup\": " << std::setprecision(6) << r.parallelizer->speedup
+              << ", \"efficiency\": " << r.parallelizer->efficiency
+              << ", \"mismatched_pixels\": " << r.parallelizer->mismatched_pixels << " }";
+        }
+        else
+        {
+            o << "null";
+        }
+        o << ",\n"
+          << "      \"tile_pool\": ";
+        if (r.tile_pool)
+        {
+            o << "{"
+              << " \"serial_ns\": " << nanoseconds(r.tile_pool->serial)
+              << ", \"concurrent_ns\": " << nanoseconds(r.tile_pool->concurrent)
+              << ", \"threads\": " << r.tile_pool->threads
+              << ", \"speedup\": " << std::setprecision(6) << r.tile_pool->speedup << " }";
+        }
+        else
+        {
+            o << "null";
+        }
+        o << "\n"
+          << "    }";
+    }
+
+    o << (results.empty() ? "]" : "\n  ]");
+
+    if (run.image_pool)
+    {
+        o << ",\n"
+          << "  \"image_pool\": { \"hits\": " << run.image_pool->hits
+          << ", \"misses\": " << run.image_pool->misses << " }";
+    }
+
+    if (run.comparison)
+    {
+        o << ",\n"
+          << "  \"baseline\": {\n"
+          << "    \"matched\": " << run.comparison->matched << ",\n"
+          << "    \"unmatched\": " << run.comparison->unmatched << ",\n"
+          << "    \"inconclusive\": " << run.comparison->inconclusive << ",\n"
+          << "    \"samples_needed\": " << run.comparison->samples_needed << ",\n"
+          << "    \"regressions\": " << run.comparison->regressions << ",\n";
+        write_changes(o, "slower", run.comparison->slower);
+        o << ",\n";
+        write_changes(o, "faster", run.comparison->faster);
+        o << "\n  }";
+    }
+
+    o << "\n}" << std::endl;
+
+    return failed_count(results) + (run.comparison ? run.comparison->regressions : 0);
+}
+
+unsigned csv_report::summary(result_list const & results, run_summary const & run)
+{
+    std::ostream & o = *s;
+
+    o << "name,state,renderer,width,height,tiles_x,tiles_y,scale_factor,envelope,image_path,error,"
+      << "duration_ns,samples_ns,min_ns,max_ns,median_ns,mean_ns,p95_ns,p99_ns,stddev_ns,tiles_duration_ns,"
+      << "load_map_ns,zoom_ns,render_ns,encode_ns,write_ns,checksum,mismatched_pixels,cached,"
+      << "allocations,allocated_bytes,peak_heap_bytes,rss_bytes,peak_rss_bytes,image_pool_hits,image_pool_misses,"
+      << "cycles,instructions,cache_misses,branch_misses,cpu_time_ns,user_time_ns,system_time_ns,"
+      << "voluntary_switches,involuntary_switches,"
+      << "serial_ns,parallel_ns,parallelizer_threads,speedup,efficiency,parallelizer_mismatched_pixels,"
+      << "tiles_serial_ns,tiles_concurrent_ns,tile_threads,tiles_speedup,"
+      << "host,cpu_model,hardware_threads,jobs,mapnik_version,start_time\n";
+
+    for (auto const & r : results)
+    {
+        duration_statistics const & stats = r.statistics;
+        phase_durations const & phases = r.phases;
+
+        std::ostringstream samples;
+        for (std::size_t j = 0; j < r.samples.size(); j++)
+        {
+            samples << (j ? ";" : "") << nanoseconds(r.samples[j]);
+        }
+
+        o << csv_field(r.name) << ','
+          << state_name(r.state) << ','
+          << csv_field(r.renderer_name) << ','
+          << r.size.width << ',' << r.size.height << ','
+          << r.tiles.width << ',' << r.tiles.height << ','
+          << std::setprecision(17) << r.scale_factor << ','
+          << csv_field(r.envelope ? envelope_string(*r.envelope) : "") << ','
+          << csv_field(r.image_path.string()) << ','
+          << csv_field(r.error_message) << ','
+          << nanoseconds(r.duration) << ','
+          << samples.str() << ','
+          << nanoseconds(stats.min) << ',' << nanoseconds(stats.max) << ','
+          << nanoseconds(stats.median) << ',' << nanoseconds(stats.mean) << ','
+          << nanoseconds(stats.p95) << ',' << nanoseconds(stats.p99) << ','
+          << nanoseconds(stats.stddev) << ','
+          << nanoseconds(r.tiles_duration) << ','
+          << nanoseconds(phases.load_map) << ',' << nanoseconds(phases.zoom) << ','
+          << nanoseconds(phases.render) << ',' << nanoseconds(phases.encode) << ','
+          << nanoseconds(phases.write) << ','
+          << (r.checksum ? hex(*r.checksum) : "") << ','
+          << (r.mismatched_pixels ? std::to_string(*r.mismatched_pixels) : "") << ','
+          << (r.cached ? "true" : "false") << ','
+          << (r.memory ? std::to_string(r.memory->allocations) : "") << ','
+          << (r.memory ? std::to_string(r.memory->bytes) : "") << ','
+          << (r.memory ? std::to_string(r.memory->peak_heap) : "") << ','
+          << (r.memory ? std::to_string(r.memory->rss) : "") << ','
+          << (r.memory ? std::to_string(r.memory->peak_rss) : "") << ','
+          << (run.image_pool ? std::to_string(run.image_pool->hits) : "") << ','
+          << (run.image_pool ? std::to_string(run.image_pool->misses) : "") << ','
+          << (r.cpu && r.cpu->cycles ? std::to_string(*r.cpu->cycles) : "") << ','
+          << (r.cpu && r.cpu->instructions ? std::to_string(*r.cpu->instructions) : "") << ','
+          << (r.cpu && r.cpu->cache_misses ? std::to_string(*r.cpu->cache_misses) : "") << ','
+          << (r.cpu && r.cpu->branch_misses ? std::to_string(*r.cpu->branch_misses) : "") << ','
+          << (r.cpu ? std::to_string(nanoseconds(r.cpu->cpu_time)) : "") << ','
+          << (r.cpu ? std::to_string(nanoseconds(r.cpu->user_time)) : "") << ','
+          << (r.cpu ? std::to_string(nanoseconds(r.cpu->system_time)) : "") << ','
+          << (r.cpu ? std::to_string(r.cpu->voluntary_switches) : "") << ','
+          << (r.cpu ? std::to_string(r.cpu->involuntary_switches) : "") << ','
+          << (r.parallelizer ? std::to_string(nanoseconds(r.parallelizer->serial)) : "") << ','
+          << (r.parallelizer ? std::to_string(nanoseconds(r.parallelizer->parallel)) : "") << ','
+          << (r.parallelizer ? std::to_string(r.parallelizer->threads) : "") << ','
+          << (r.parallelizer ? std::to_string(r.parallelizer->speedup) : "") << ','
+          << (r.parallelizer ? std::to_string(r.parallelizer->efficiency) : "") << ','
+          << (r.parallelizer ? std::to_string(r.parallelizer->mismatched_pixels) : "") << ','
+          << (r.tile_pool ? std::to_string(nanoseconds(r.tile_pool->serial)) : "") << ','
+          << (r.tile_pool ? std::to_string(nanoseconds(r.tile_pool->concurrent)) : "") << ','
+          << (r.tile_pool ? std::to_string(r.tile_pool->threads) : "") << ','
+          << (r.tile_pool ? std::to_string(r.tile_pool->speedup) : "") << ','
+          << csv_field(metadata.host) << ','
+          << csv_field(metadata.cpu_model) << ','
+          << metadata.hardware_threads << ','
+          << metadata.jobs << ','
+          << csv_field(metadata.mapnik_version) << ','
+          << metadata.start_time << '\n';
+    }
+
+    o.flush();
+
+    return failed_count(results) + (run.comparison ? run.comparison->regressions : 0);
+}
+
 }
@@ -24,14 +24,46 @@
 #define CONSOLE_REPORT_HPP
 
 #include <iostream>
+#include <memory>
+#include <string>
 
 #include <mapnik/util/variant.hpp>
 
 #include "config.hpp"
+#include "baseline.hpp"
 
 namespace mapnik_render
 {
 
+// Describes environment of a run in machine readable reports.
+struct run_metadata
+{
+    std::string host;
+    std::string cpu_model;
+    unsigned hardware_threads = 0;
+    std::size_t jobs = 1;
+    std::string mapnik_version;
+    std::string start_time;
+
+    static run_metadata collect(std::size_t jobs);
+};
+
+// Run-wide information summarized next to results.
+struct run_summary
+{
+    boost::optional<baseline_comparison> comparison;
+    boost::optional<image_pool_usage> image_pool;
+};
+
+char const * state_name(result_state state);
+
+// Quoted and escaped JSON string.
+std::string json_string(std::string const & str);
+
+// Envelope as minx,miny,maxx,maxy, exact enough to be parsed back to the
+// same box.
+std::string envelope_string(mapnik::box2d<double> const & box);
+
 class console_report
 {
 public:
@@ -44,9 +76,11 @@ public:
     }
 
     void report(result const & r);
-    unsigned summary(result_list const & results);
+    unsigned summary(result_list const & results, run_summary const & run);
 
 protected:
+    void print_change(baseline_change const & change, char const * direction);
+
     std::ostream & s;
     bool show_duration;
 };
@@ -65,7 +99,47 @@ public:
     void report(result const & r);
 };
 
-using report_type = mapnik::util::variant<console_report, console_short_report>;
+// Writes whole run as one JSON document when summary is made.
+class json_report
+{
+public:
+    json_report(std::shared_ptr<std::ostream> const & _s, run_metadata const & _metadata)
+        : s(_s), metadata(_metadata)
+    {
+    }
+
+    void report(result const &)
+    {
+    }
+
+    unsigned summary(result_list const & results, run_summary const & run);
+
+private:
+    std::shared_ptr<std::ostream> s;
+    run_metadata metadata;
+};
+
+// Writes one row per result, run metadata is repeated in every row.
+class csv_report
+{
+public:
+    csv_report(std::shared_ptr<std::ostream> const & _s, run_metadata const & _metadata)
+        : s(_s), metadata(_metadata)
+    {
+    }
+
+    void report(result const &)
+    {
+    }
+
+    unsigned summary(result_list const & results, run_summary const & run);
+
+private:
+    std::shared_ptr<std::ostream> s;
+    run_metadata metadata;
+};
+
+using report_type = mapnik::util::variant<console_report, console_short_report, json_report, csv_report>;
 
 class report_visitor
 {
@@ -88,19 +162,20 @@ private:
 class summary_visitor
 {
 public:
-    summary_visitor(result_list const & r)
-        : result_(r)
+    summary_visitor(result_list const & r, run_summary const & run)
+        : result_(r), run_(run)
     {
     }
 
     template <typename T>
     unsigned operator()(T & report) const
     {
-        return report.summary(result_);
+        return report.summary(result_, run_);
     }
 
 private:
     result_list const & result_;
+    run_summary const & run_;
 };
 
 }
@@ -20,8 +20,19 @@
  *
  *****************************************************************************/
 
+#include <thread>
+#include <sstream>
+#include <fstream>
+#include <memory>
+#include <iomanip>
+#include <iterator>
+
 #include "runner.hpp"
 #include "config.hpp"
+#include "baseline.hpp"
+#include "seeder.hpp"
+#include "daemon.hpp"
+#include "shard.hpp"
 
 #include <mapnik/datasource_cache.hpp>
 #include <mapnik/font_engine_freetype.hpp>
@@ -44,60 +55,177 @@ using namespace mapnik_render;
 namespace po = boost::program_options;
 
 runner::renderer_container create_renderers(po::variables_map const & args,
-                                            boost::filesystem::path const & output_dir,
+                                            renderer_options const & options,
                                             bool force_append = false)
 {
     runner::renderer_container renderers;
 
     if (force_append || args.count(agg_renderer::name))
     {
-        renderers.emplace_back(renderer<agg_renderer>(output_dir));
+        renderers.emplace_back(renderer<agg_renderer>(options));
     }
 #if defined(HAVE_CAIRO)
     if (force_append || args.count(cairo_renderer::name))
     {
-        renderers.emplace_back(renderer<cairo_renderer>(output_dir));
+        renderers.emplace_back(renderer<cairo_renderer>(options));
     }
 #ifdef CAIRO_HAS_SVG_SURFACE
     if (args.count(cairo_svg_renderer::name))
     {
-        renderers.emplace_back(renderer<cairo_svg_renderer>(output_dir));
+        renderers.emplace_back(renderer<cairo_svg_renderer>(options));
     }
 #endif
 #ifdef CAIRO_HAS_PS_SURFACE
     if (args.count(cairo_ps_renderer::name))
     {
-        renderers.emplace_back(renderer<cairo_ps_renderer>(output_dir));
+        renderers.emplace_back(renderer<cairo_ps_renderer>(options));
     }
 #endif
 #ifdef CAIRO_HAS_PDF_SURFACE
     if (args.count(cairo_pdf_renderer::name))
     {
-        renderers.emplace_back(renderer<cairo_pdf_renderer>(output_dir));
+        renderers.emplace_back(renderer<cairo_pdf_renderer>(options));
     }
 #endif
 #endif
 #if defined(SVG_RENDERER)
     if (force_append || args.count(svg_renderer::name))
     {
-        renderers.emplace_back(renderer<svg_renderer>(output_dir));
+        renderers.emplace_back(renderer<svg_renderer>(options));
     }
 #endif
 #if defined(GRID_RENDERER)
     if (force_append || args.count(grid_renderer::name))
     {
-        renderers.emplace_back(renderer<grid_renderer>(output_dir));
+        renderers.emplace_back(renderer<grid_renderer>(options));
+    }
+    if (args.count(utfgrid_renderer::name))
+    {
+        renderers.emplace_back(renderer<utfgrid_renderer>(options));
     }
 #endif
 
     if (renderers.empty())
     {
-        return create_renderers(args, output_dir, true);
+        return create_renderers(args, options, true);
     }
 
     return renderers;
 }
 
+report_type create_report(po::variables_map const & args,
+                          std::shared_ptr<std::ostream> const & stream,
+                          std::size_t jobs)
+{
+    bool show_duration = args.count("duration");
+    std::string format(args["report"].as<std::string>());
+
+    if (format == "json")
+    {
+        return json_report(stream, run_metadata::collect(jobs));
+    }
+    if (format == "csv")
+    {
+        return csv_report(stream, run_metadata::collect(jobs));
+    }
+    return args.count("verbose") ?
+        report_type((console_report(show_duration))) :
+        report_type((console_short_report(show_duration)));
+}
+
+// Tiles are written synchronously by seeding workers, --jobs sets parallelism.
+int seed(po::variables_map const & args, renderer_options const & options, std::size_t jobs)
+{
+    seed_config cfg;
+    std::string zoom(args["zoom"].as<std::string>());
+    std::size_t dash = zoom.find('-');
+    try
+    {
+        cfg.min_zoom = std::stoul(zoom.substr(0, dash));
+        cfg.max_zoom = dash == std::string::npos ? cfg.min_zoom : std::stoul(zoom.substr(dash + 1));
+    }
+    catch (std::exception const &)
+    {
+        std::cerr << "Error: Invalid zoom range: " << zoom << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (cfg.min_zoom > cfg.max_zoom || cfg.max_zoom > 30)
+    {
+        std::cerr << "Error: Invalid zoom range: " << zoom << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (args.count("envelope"))
+    {
+        cfg.envelope.from_string(args["envelope"].as<std::string>());
+    }
+    cfg.metatile = args["metatile"].as<std::size_t>();
+    cfg.buffer = args["metatile-buffer"].as<std::size_t>();
+    cfg.tile_size = args["tile-size"].as<std::size_t>();
+    cfg.scale_factor = args["scale-factor"].as<std::vector<double>>().front();
+
+    if (!args.count("styles"))
+    {
+        std::cerr << "Error: no input styles." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    renderer_options seed_options(options);
+    seed_options.reference_dir = boost::none;
+    seeder s(cfg, jobs, create_renderers(args, seed_options));
+
+    std::size_t errors = 0;
+    for (auto const & r : s.seed(args["styles"].as<std::vector<std::string>>()))
+    {
+        double seconds = std::chrono::duration<double>(r.duration).count();
+        std::clog << "\"" << r.name << "\" with " << r.renderer_name << "... "
+                  << r.tiles << " tiles / " << r.metatiles << " metatiles / " << r.errors << " errors in "
+                  << std::fixed << std::setprecision(3) << seconds << " s ("
+                  << std::setprecision(1) << (seconds > 0 ? r.tiles / seconds : 0.0) << " tiles/s)";
+        if (!r.error_message.empty())
+        {
+            std::clog << " last error: " << r.error_message;
+        }
+        std::clog << std::endl;
+        errors += r.errors;
+    }
+
+    return errors > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Requests are answered synchronously, --jobs sets number of socket clients
+// served at once.
+int serve(po::variables_map const & args, renderer_options const & options, std::size_t jobs)
+{
+    renderer_options file_options(options);
+    file_options.reference_dir = boost::none;
+    file_options.sink = file_sink();
+    // Inline replies are saved to memory and taken from there.
+    memory_sink replies;
+    renderer_options inline_options(file_options);
+    inline_options.sink = replies;
+    render_daemon d(create_renderers(args, file_options), create_renderers(args, inline_options), replies, jobs);
+
+    try
+    {
+        if (args.count("socket"))
+        {
+            d.serve(boost::filesystem::path(args["socket"].as<std::string>()));
+        }
+        else
+        {
+            d.serve(std::cin, std::cout);
+        }
+    }
+    catch (std::exception const & e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
 int main(int argc, char** argv)
 {
     po::options_description desc("mapnik-render");
@@ -105,8 +233,43 @@ int main(int argc, char** argv)
         ("help,h", "produce usage message")
         ("verbose,v", "verbose output")
         ("duration,d", "output rendering duration")
+        ("report", po::value<std::string>()->default_value("console"), "report format (console, json, csv)")
+        ("report-file", po::value<std::string>(), "write json or csv report to this file instead of standard output")
         ("iterations,i", po::value<std::size_t>()->default_value(1), "number of iterations for benchmarking")
+        ("warmup", po::value<std::size_t>()->default_value(0), "number of iterations rendered before measurement")
+        ("min-time", po::value<double>()->default_value(0), "minimal measured time per configuration in seconds")
+        ("max-cv", po::value<double>()->default_value(0), "iterate until coefficient of variation of durations drops below this value")
+        ("max-time", po::value<double>()->default_value(10), "time budget in seconds for reaching --max-cv")
+        ("memory", "count heap allocations and peak heap of every render, report resident set size")
+        ("trace", po::value<std::string>(), "write timeline of load_map, zoom, render, encode and write phases as Chrome trace events to this file")
+        ("cpu-counters", "count cycles, instructions, cache and branch misses, CPU time and context switches of renders")
+        ("jobs,j", po::value<std::size_t>()->default_value(1), "number of parallel jobs, 0 for number of CPUs")
+        ("tile-threads", po::value<std::size_t>()->default_value(1), "number of threads rendering tiles concurrently, 0 for number of CPUs")
+        ("tile-compare", "render tiled jobs also one tile after another and report speedup of tile threads")
+        ("write-threads", po::value<std::size_t>()->default_value(0), "number of background threads encoding and writing images, 0 to write on rendering thread")
+        ("write-queue", po::value<std::size_t>()->default_value(16), "maximal number of images waiting for background writer")
+        ("parallelizer", po::value<std::string>()->default_value("auto"), "AGG rendering with mapnik::parallelizer (auto, off, on, compare with serial rendering)")
+        ("parallelizer-threads", po::value<std::size_t>()->default_value(0), "number of parallelizer threads, 0 to let mapnik decide")
+        ("image-pool", po::value<std::size_t>()->default_value(0), "MiB of raster images kept for reuse by renders of the same size, 0 to disable")
         ("output-dir", po::value<std::string>()->default_value("./"), "directory for output files")
+        ("output", po::value<std::string>()->default_value(file_sink::name), "where rendered images go (file, null, memory, checksum)")
+        ("memory-output", po::value<std::size_t>()->default_value(256), "MiB of encoded images kept by memory output, oldest are dropped")
+        ("reference-dir", po::value<std::string>(), "compare rendered images with images of the same name in this directory")
+        ("tolerance", po::value<unsigned>()->default_value(0), "maximal difference of a color channel for pixels to match")
+        ("cache", po::value<std::string>(), "file with results of previous runs, unchanged configurations are not rendered again")
+        ("baseline", po::value<std::string>(), "JSON report of previous run, list configurations significantly slower or faster")
+        ("significance", po::value<double>()->default_value(0.05), "p-value below which a difference from baseline is significant")
+        ("regression-threshold", po::value<double>(), "count configurations slower than baseline by more than this percentage as failures")
+        ("shard", po::value<std::string>(), "run only part i/N of the jobs, split by durations of --shard-durations")
+        ("shard-durations", po::value<std::string>(), "JSON report of an earlier run used to balance shards")
+        ("merge", po::value<std::vector<std::string>>()->multitoken(), "combine JSON reports of shards into one report instead of rendering")
+        ("seed", "render XYZ tile pyramid of --envelope in spherical mercator instead of benchmarking")
+        ("zoom", po::value<std::string>()->default_value("0-5"), "zoom levels to seed, e.g. 0-14")
+        ("metatile", po::value<std::size_t>()->default_value(8), "tiles per side of a metatile rendered at once")
+        ("metatile-buffer", po::value<std::size_t>()->default_value(128), "pixels rendered around a metatile")
+        ("tile-size", po::value<std::size_t>()->default_value(256), "size of seeded tiles in pixels")
+        ("daemon", "keep fonts, plugins and styles loaded and render requests read from standard input or --socket")
+        ("socket", po::value<std::string>(), "Unix socket path the daemon listens on")
         ("styles", po::value<std::vector<std::string>>(), "selected styles to test")
         ("fonts", po::value<std::string>()->default_value("fonts"), "font search path")
         ("plugins", po::value<std::string>()->default_value("plugins/input"), "input plugins search path")
@@ -137,6 +300,9 @@ int main(int argc, char** argv)
 #endif
 #if defined(GRID_RENDERER)
         (grid_renderer::name, "render with Grid renderer")
+        (utfgrid_renderer::name, "render UTFGrid JSON with Grid renderer")
+        ("utfgrid-resolution", po::value<unsigned>()->default_value(4), "UTFGrid resolution, pixels per grid character")
+        ("utfgrid-fields", po::value<std::string>()->default_value(""), "comma separated feature attributes written to UTFGrid data")
 #endif
         ;
 
@@ -169,7 +335,8 @@ int main(int argc, char** argv)
     mapnik::freetype_engine::register_fonts(vm["fonts"].as<std::string>(), true);
     mapnik::datasource_cache::instance().register_datasources(vm["plugins"].as<std::string>());
 
-    boost::filesystem::path output_dir(vm["output-dir"].as<std::string>());
+    renderer_options options;
+    options.output_dir = vm["output-dir"].as<std::string>();
 
     config defaults;
     defaults.scales = vm["scale-factor"].as<std::vector<double>>();
@@ -195,33 +362,267 @@ int main(int argc, char** argv)
         parse_map_sizes(map_sizes_parser, tiles, defaults.tiles);
     }
 
-    runner run(defaults,
-               vm["iterations"].as<std::size_t>(),
-               create_renderers(vm, output_dir));
+    std::size_t jobs = vm["jobs"].as<std::size_t>();
+    if (jobs == 0)
+    {
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    }
 
-    bool show_duration = vm.count("duration");
-    report_type report(vm.count("verbose") ?
-        report_type((console_report(show_duration))) :
-        report_type((console_short_report(show_duration))));
-    result_list results;
+    std::size_t tile_threads = vm["tile-threads"].as<std::size_t>();
+    if (tile_threads == 0)
+    {
+        tile_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
 
-    if (!vm.count("styles"))
+    if (tile_threads > 1)
     {
-        std::cerr << "Error: no input styles." << std::endl;
+        options.tile_pool = std::make_shared<thread_pool>(tile_threads);
+    }
+
+    options.tile_compare = vm.count("tile-compare") > 0;
+    if (options.tile_compare && !options.tile_pool)
+    {
+        std::cerr << "Error: Tile comparison needs more than one tile thread." << std::endl;
         return EXIT_FAILURE;
     }
 
+    iteration_config iterations;
+    iterations.iterations = vm["iterations"].as<std::size_t>();
+    iterations.warmup = vm["warmup"].as<std::size_t>();
+    iterations.min_time = std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(
+        std::chrono::duration<double>(vm["min-time"].as<double>()));
+    iterations.max_cv = vm["max-cv"].as<double>();
+    iterations.max_time = std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(
+        std::chrono::duration<double>(vm["max-time"].as<double>()));
+    iterations.memory = vm.count("memory") > 0;
+    iterations.cpu = vm.count("cpu-counters") > 0;
+
     try
     {
-        results = run.test(vm["styles"].as<std::vector<std::string>>(), report);
+        options.sink = create_sink(vm["output"].as<std::string>(),
+                                   vm["memory-output"].as<std::size_t>() * 1024 * 1024);
+        options.parallelizer = parse_parallelizer_mode(vm["parallelizer"].as<std::string>());
     }
-    catch (std::exception & e)
+    catch (std::exception const & e)
     {
         std::cerr << "Error: " << e.what() << std::endl;
         return EXIT_FAILURE;
     }
 
-    unsigned failed_count = mapnik::util::apply_visitor(summary_visitor(results), report);
+    options.parallelizer_threads = vm["parallelizer-threads"].as<std::size_t>();
+    if (options.parallelizer_threads > 0 && !parallelizer_threads_support<mapnik::image_rgba8>::value)
+    {
+        std::cerr << "Error: This mapnik build does not allow setting parallelizer thread count." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+#if defined(GRID_RENDERER)
+    options.grid_resolution = vm["utfgrid-resolution"].as<unsigned>();
+    std::istringstream fields(vm["utfgrid-fields"].as<std::string>());
+    for (std::string field; std::getline(fields, field, ',');)
+    {
+        if (!field.empty())
+        {
+            options.grid_fields.push_back(field);
+        }
+    }
+#endif
+
+    if (vm["image-pool"].as<std::size_t>() > 0)
+    {
+        options.buffers = std::make_shared<image_pool<mapnik::image_rgba8>>(
+            vm["image-pool"].as<std::size_t>() * 1024 * 1024);
+    }
+
+    if (vm.count("seed"))
+    {
+        return seed(vm, options, jobs);
+    }
+
+    if (vm.count("daemon"))
+    {
+        return serve(vm, options, jobs);
+    }
+
+    if (vm["write-threads"].as<std::size_t>() > 0)
+    {
+        options.writer = std::make_shared<image_writer>(vm["write-threads"].as<std::size_t>(),
+                                                        vm["write-queue"].as<std::size_t>());
+    }
+
+    if (vm.count("reference-dir"))
+    {
+        options.reference_dir = boost::filesystem::path(vm["reference-dir"].as<std::string>());
+    }
+    options.tolerance = vm["tolerance"].as<unsigned>();
+
+    std::shared_ptr<render_cache> cache;
+    if (vm.count("cache"))
+    {
+        std::ostringstream context;
+        context << "output=" << vm["output"].as<std::string>()
+                << ";output-dir=" << boost::filesystem::absolute(options.output_dir).string()
+                << ";reference-dir=" << (options.reference_dir ? options.reference_dir->string() : "")
+                << ";tolerance=" << options.tolerance
+                << ";iterations=" << iterations.iterations
+                << ";warmup=" << iterations.warmup
+                << ";min-time=" << iterations.min_time.count()
+                << ";max-cv=" << iterations.max_cv
+                << ";max-time=" << iterations.max_time.count()
+                << ";memory=" << iterations.memory
+                << ";cpu-counters=" << iterations.cpu
+                << ";parallelizer=" << vm["parallelizer"].as<std::string>()
+                << ";parallelizer-threads=" << options.parallelizer_threads
+                << ";tile-compare=" << options.tile_compare
+                << ";fonts=" << vm["fonts"].as<std::string>()
+                << ':' << std::hex << render_cache::path_hash(vm["fonts"].as<std::string>()) << std::dec;
+        cache = std::make_shared<render_cache>(vm["cache"].as<std::string>(),
+                                               context.str(),
+                                               vm["output"].as<std::string>() == file_sink::name,
+                                               options.reference_dir);
+        cache->load();
+    }
+
+    std::shared_ptr<shard_config> shard;
+    if (vm.count("shard"))
+    {
+        shard = std::make_shared<shard_config>();
+        try
+        {
+            shard->spec = shard_spec::parse(vm["shard"].as<std::string>());
+            if (vm.count("shard-durations"))
+            {
+                shard->costs = job_costs(vm["shard-durations"].as<std::string>());
+            }
+        }
+        catch (std::exception const & e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::shared_ptr<trace_log> trace;
+    if (vm.count("trace"))
+    {
+        trace = std::make_shared<trace_log>();
+    }
+
+    runner run(defaults,
+               iterations,
+               jobs,
+               create_renderers(vm, options),
+               options.writer,
+               cache,
+               shard,
+               trace);
+
+    std::string report_format(vm["report"].as<std::string>());
+    if (report_format != "console" && report_format != "json" && report_format != "csv")
+    {
+        std::cerr << "Error: Unknown report format: " << report_format << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::shared_ptr<std::ostream> report_stream(&std::cout, [](std::ostream *) {});
+    if (vm.count("report-file"))
+    {
+        std::string report_file(vm["report-file"].as<std::string>());
+        report_stream = std::make_shared<std::ofstream>(report_file.c_str(), std::ios::out | std::ios::trunc);
+        if (!*report_stream)
+        {
+            std::cerr << "Error: Cannot open report file: " << report_file << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::unique_ptr<baseline> previous;
+    if (vm.count("baseline"))
+    {
+        boost::optional<double> threshold;
+        if (vm.count("regression-threshold"))
+        {
+            threshold = vm["regression-threshold"].as<double>();
+        }
+        try
+        {
+            previous.reset(new baseline(vm["baseline"].as<std::string>(),
+                                        vm["significance"].as<double>(),
+                                        threshold));
+        }
+        catch (std::exception const & e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    report_type report(create_report(vm, report_stream, jobs));
+    result_list results;
+
+    if (vm.count("merge"))
+    {
+        try
+        {
+            for (auto const & file : vm["merge"].as<std::vector<std::string>>())
+            {
+                result_list shard_results(read_json_results(file));
+                std::move(shard_results.begin(), shard_results.end(), std::back_inserter(results));
+            }
+        }
+        catch (std::exception const & e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+        for (auto const & r : results)
+        {
+            mapnik::util::apply_visitor(report_visitor(r), report);
+        }
+    }
+    else
+    {
+        if (!vm.count("styles"))
+        {
+            std::cerr << "Error: no input styles." << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        try
+        {
+            results = run.test(vm["styles"].as<std::vector<std::string>>(), report);
+        }
+        catch (std::exception & e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (trace)
+    {
+        try
+        {
+            trace->write(vm["trace"].as<std::string>());
+        }
+        catch (std::exception const & e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    run_summary summary;
+    if (previous)
+    {
+        summary.comparison = previous->compare(results);
+    }
+    if (options.buffers)
+    {
+        summary.image_pool = options.buffers->usage();
+    }
+
+    unsigned failed_count = mapnik::util::apply_visitor(summary_visitor(results, summary), report);
 
     return failed_count;
 }
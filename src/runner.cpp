@@ -23,10 +23,20 @@
 #include <algorithm>
 #include <future>
 #include <atomic>
+#include <cmath>
+#include <thread>
+#include <mutex>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
 
 #include <mapnik/load_map.hpp>
 
 #include "runner.hpp"
+#include "thread_pool.hpp"
+#include "memory.hpp"
+#include "cpu_counters.hpp"
+#include "trace.hpp"
 
 namespace mapnik_render
 {
@@ -38,56 +48,229 @@ public:
                      mapnik::Map & map,
                      map_size const & tiles,
                      double scale_factor,
-                     result_list & results,
-                     report_type & report,
-                     std::size_t iterations)
+                     iteration_config const & iterations,
+                     phase_durations const & phases,
+                     result & r)
         : name_(name),
           map_(map),
           tiles_(tiles),
           scale_factor_(scale_factor),
-          results_(results),
-          report_(report),
-          iterations_(iterations)
+          iterations_(iterations),
+          phases_(phases),
+          result_(r)
     {
     }
 
-    template <typename T, typename std::enable_if<T::renderer_type::support_tiles>::type* = nullptr>
-    void operator()(T const& renderer) const
+    template <typename T>
+    void operator()(T const & renderer) const
     {
-        test(renderer);
+        map_size size { map_.width(), map_.height() };
+        std::chrono::high_resolution_clock::duration tiles_duration(std::chrono::high_resolution_clock::duration::zero());
+
+        std::chrono::high_resolution_clock::time_point render_start(std::chrono::high_resolution_clock::now());
+        for (std::size_t i = 0; i < iterations_.warmup; i++)
+        {
+            std::chrono::high_resolution_clock::duration warmup_tiles_duration(std::chrono::high_resolution_clock::duration::zero());
+            trace_span span("warmup");
+            renderer.recycle(render(renderer, warmup_tiles_duration));
+        }
+
+        std::vector<duration_type> samples;
+        samples.reserve(iterations_.iterations);
+        duration_type measured(duration_type::zero());
+        double mean = 0;
+        double squares = 0;
+        boost::optional<memory_usage> memory;
+        std::unique_ptr<cpu_counters> cpu(iterations_.cpu && cpu_countable(renderer) ? new cpu_counters : nullptr);
+        cpu_usage cpu_total;
+        while (true)
+        {
+            // Counters live on the heap, allocating them must not be counted.
+            std::unique_ptr<memory_counters> counters(iterations_.memory ? new memory_counters : nullptr);
+            if (cpu)
+            {
+                cpu->start();
+            }
+            std::chrono::high_resolution_clock::time_point start(std::chrono::high_resolution_clock::now());
+            typename T::image_type image(render(renderer, tiles_duration, counters.get()));
+            std::chrono::high_resolution_clock::time_point end(std::chrono::high_resolution_clock::now());
+            if (cpu)
+            {
+                cpu->stop(cpu_total);
+            }
+            if (counters)
+            {
+                memory = counters->usage();
+                read_rss(*memory);
+            }
+            samples.push_back(end - start);
+            measured += samples.back();
+
+            // Welford's online update of mean and sum of squared differences.
+            double sample = samples.back().count();
+            double delta = sample - mean;
+            mean += delta / samples.size();
+            squares += delta * (sample - mean);
+
+            if (done(samples.size(), measured, mean, squares))
+            {
+                duration_type render_duration(std::chrono::high_resolution_clock::now() - render_start);
+                result_ = renderer.report(name_, size, tiles_, scale_factor_, map_.get_current_extent());
+                result_.phases = phases_;
+                result_.phases.render = render_duration;
+                result_.duration = measured;
+                result_.statistics = compute_statistics(samples);
+                result_.samples = std::move(samples);
+                result_.tiles_duration = tiles_duration;
+                result_.memory = memory;
+                if (cpu)
+                {
+                    result_.cpu = cpu_counters::mean(cpu_total, result_.samples.size());
+                }
+                compare_parallelizer(renderer, image);
+                compare_tiles(renderer);
+                renderer.save(std::move(image), result_);
+                return;
+            }
+
+            renderer.recycle(std::move(image));
+        }
     }
 
-    template <typename T, typename std::enable_if<!T::renderer_type::support_tiles>::type* = nullptr>
-    void operator()(T const & renderer) const
+private:
+    // CPU counters see the calling thread only, renders running partly on
+    // other threads would be reported as nearly free.
+    template <typename T>
+    bool cpu_countable(T const & renderer) const
     {
-        if (tiles_.width == 1 && tiles_.height == 1)
+        if (!renderer.off_thread(map_, tiles_))
         {
-            test(renderer);
+            return true;
         }
+        static std::once_flag warned;
+        std::call_once(warned, []()
+        {
+            std::clog << "Warning: CPU counters are not reported for renders using tile threads "
+                         "or parallelizer, they count the calling thread only." << std::endl;
+        });
+        return false;
     }
 
-private:
     template <typename T>
-    void test(T const & renderer) const
+    void compare_parallelizer(T const &, typename T::image_type const &) const
     {
-        map_size size { map_.width(), map_.height() };
-        std::chrono::high_resolution_clock::time_point start(std::chrono::high_resolution_clock::now());
-        for (std::size_t i = iterations_ ; i > 0; i--)
+    }
+
+    // Renders the job serially as many times as it was measured and compares
+    // durations and pixels with the last measured render.
+    void compare_parallelizer(renderer<agg_renderer> const & renderer, mapnik::image_rgba8 const & image) const
+    {
+        agg_renderer const & agg = renderer.get();
+        if (agg.parallelizer != PARALLELIZER_COMPARE ||
+            tiles_.width > 1 || tiles_.height > 1 ||
+            !mapnik::parallelizer::is_parallelizable(map_))
+        {
+            return;
+        }
+
+        std::vector<duration_type> samples;
+        parallelizer_comparison comparison;
+        for (std::size_t i = 0; i < result_.samples.size(); i++)
+        {
+            std::chrono::high_resolution_clock::time_point start(std::chrono::high_resolution_clock::now());
+            mapnik::image_rgba8 serial(agg.render(map_, scale_factor_, false));
+            samples.push_back(std::chrono::high_resolution_clock::now() - start);
+            if (i + 1 == result_.samples.size())
+            {
+                comparison.mismatched_pixels = compare_pixels(
+                    reinterpret_cast<std::uint32_t const *>(serial.bytes()),
+                    reinterpret_cast<std::uint32_t const *>(image.bytes()),
+                    image.width() * image.height(),
+                    0);
+            }
+            renderer.recycle(std::move(serial));
+        }
+
+        comparison.serial = compute_statistics(samples).median;
+        comparison.parallel = result_.statistics.median;
+        comparison.threads = agg.threads > 0 ? agg.threads : std::max(1u, std::thread::hardware_concurrency());
+        if (comparison.parallel.count() > 0)
         {
-            typename T::image_type image(render(renderer));
-            if (i == 1)
+            comparison.speedup = static_cast<double>(comparison.serial.count()) / comparison.parallel.count();
+            comparison.efficiency = comparison.speedup / comparison.threads;
+        }
+        result_.parallelizer = comparison;
+    }
+
+    template <typename T, typename std::enable_if<!T::renderer_type::support_tiles>::type* = nullptr>
+    void compare_tiles(T const &) const
+    {
+    }
+
+    // Renders the tiles one by one as many times as they were measured on
+    // tile pool and compares the medians.
+    template <typename T, typename std::enable_if<T::renderer_type::support_tiles>::type* = nullptr>
+    void compare_tiles(T const & renderer) const
+    {
+        std::size_t threads = renderer.tile_compare_threads(tiles_);
+        if (threads == 0)
+        {
+            return;
+        }
+
+        std::vector<duration_type> samples;
+        for (std::size_t i = 0; i < result_.samples.size(); i++)
+        {
+            std::chrono::high_resolution_clock::duration tiles_duration(std::chrono::high_resolution_clock::duration::zero());
+            trace_span span("serial_tiles");
+            std::chrono::high_resolution_clock::time_point start(std::chrono::high_resolution_clock::now());
+            typename T::image_type serial(renderer.render(map_, scale_factor_, tiles_, tiles_duration, nullptr));
+            samples.push_back(std::chrono::high_resolution_clock::now() - start);
+            renderer.recycle(std::move(serial));
+        }
+
+        tile_comparison comparison;
+        comparison.serial = compute_statistics(samples).median;
+        comparison.concurrent = result_.statistics.median;
+        comparison.threads = threads;
+        if (comparison.concurrent.count() > 0)
+        {
+            comparison.speedup = static_cast<double>(comparison.serial.count()) / comparison.concurrent.count();
+        }
+        result_.tile_pool = comparison;
+    }
+
+    bool done(std::size_t count, duration_type measured, double mean, double squares) const
+    {
+        if (count < std::max<std::size_t>(iterations_.iterations, 1) || measured < iterations_.min_time)
+        {
+            return false;
+        }
+        if (iterations_.max_cv > 0 && measured < iterations_.max_time)
+        {
+            if (count < 2 || mean <= 0)
             {
-                std::chrono::high_resolution_clock::time_point end(std::chrono::high_resolution_clock::now());
-                result r(renderer.report(image, name_, size, tiles_, scale_factor_, map_.get_current_extent()));
-                r.duration = end - start;
-                mapnik::util::apply_visitor(report_visitor(r), report_);
-                results_.push_back(std::move(r));
+                return false;
             }
+            double cv = std::sqrt(squares / (count - 1)) / mean;
+            return cv <= iterations_.max_cv;
         }
+        return true;
+    }
+
+    template <typename T>
+    typename T::image_type render(T const& renderer,
+                                  std::chrono::high_resolution_clock::duration & tiles_duration,
+                                  memory_counters * counters) const
+    {
+        memory_scope scope(counters);
+        trace_span span("render");
+        return render(renderer, tiles_duration);
     }
 
     template <typename T, typename std::enable_if<T::renderer_type::support_tiles>::type* = nullptr>
-    typename T::image_type render(T const& renderer) const
+    typename T::image_type render(T const& renderer,
+                                  std::chrono::high_resolution_clock::duration & tiles_duration) const
     {
         if (tiles_.width == 1 && tiles_.height == 1)
         {
@@ -95,12 +278,13 @@ private:
         }
         else
         {
-            return renderer.render(map_, scale_factor_, tiles_);
+            return renderer.render(map_, scale_factor_, tiles_, tiles_duration);
         }
     }
 
     template <typename T, typename std::enable_if<!T::renderer_type::support_tiles>::type* = nullptr>
-    typename T::image_type render(T const & renderer) const
+    typename T::image_type render(T const & renderer,
+                                  std::chrono::high_resolution_clock::duration &) const
     {
         return renderer.render(map_, scale_factor_);
     }
@@ -109,21 +293,173 @@ private:
     mapnik::Map & map_;
     map_size const & tiles_;
     double scale_factor_;
-    result_list & results_;
-    report_type & report_;
-    std::size_t iterations_;
+    iteration_config const & iterations_;
+    phase_durations const & phases_;
+    result & result_;
+};
+
+struct support_tiles_visitor
+{
+    template <typename T>
+    bool operator()(T const &) const
+    {
+        return T::renderer_type::support_tiles;
+    }
 };
 
+// Whether renderer measures serial rendering next to parallelizer.
+struct parallelizer_compare_visitor
+{
+    template <typename T>
+    bool operator()(T const &) const
+    {
+        return false;
+    }
+
+    bool operator()(renderer<agg_renderer> const & r) const
+    {
+        return r.get().parallelizer == PARALLELIZER_COMPARE;
+    }
+};
+
+// Whether renderer measures tiles rendered one by one next to tile pool.
+struct tile_compare_visitor
+{
+    tile_compare_visitor(map_size const & tiles)
+        : tiles_(tiles)
+    {
+    }
+
+    template <typename T>
+    bool operator()(T const & r) const
+    {
+        return r.tile_compare_threads(tiles_) > 0;
+    }
+
+    map_size const & tiles_;
+};
+
+struct renderer_name_visitor
+{
+    template <typename T>
+    std::string operator()(T const &) const
+    {
+        return T::renderer_type::name;
+    }
+};
+
+// Maps loaded by one worker. The few most recently used styles stay loaded,
+// so jobs of interleaved styles, e.g. stolen from other workers, do not load
+// them again.
+struct worker_map
+{
+    // Sets load_duration to the time spent loading the style, zero when
+    // the map was already loaded. A map is kept only when it loaded fully.
+    // Maps loaded while planning are taken with their load time.
+    mapnik::Map & get(boost::filesystem::path const & style_path, duration_type & load_duration)
+    {
+        load_duration = duration_type::zero();
+        for (auto it = maps.begin(); it != maps.end(); ++it)
+        {
+            if (it->first == style_path)
+            {
+                maps.splice(maps.begin(), maps, it);
+                return *maps.front().second;
+            }
+        }
+
+        loaded_maps::entry loaded;
+        if (planned)
+        {
+            loaded = planned->take(style_path);
+        }
+        std::unique_ptr<mapnik::Map> map(std::move(loaded.map));
+        if (map)
+        {
+            load_duration = loaded.load_duration;
+        }
+        else
+        {
+            trace_span span("load_map");
+            std::chrono::high_resolution_clock::time_point start(std::chrono::high_resolution_clock::now());
+            map.reset(new mapnik::Map(default_size.width, default_size.height));
+            mapnik::load_map(*map, style_path.string(), true);
+            load_duration = std::chrono::high_resolution_clock::now() - start;
+        }
+
+        maps.emplace_front(style_path, std::move(map));
+        if (maps.size() > capacity)
+        {
+            maps.pop_back();
+        }
+        return *maps.front().second;
+    }
+
+    static const map_size default_size;
+    static const std::size_t capacity = 4;
+    // Most recently used first.
+    std::list<std::pair<boost::filesystem::path, std::unique_ptr<mapnik::Map>>> maps;
+    loaded_maps * planned = nullptr;
+};
+
+const map_size worker_map::default_size(512, 512);
+const std::size_t worker_map::capacity;
+
+void loaded_maps::put(boost::filesystem::path const & style_path, entry e)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    maps_[style_path.string()] = std::move(e);
+}
+
+loaded_maps::entry loaded_maps::take(boost::filesystem::path const & style_path)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    entry e;
+    auto it = maps_.find(style_path.string());
+    if (it != maps_.end())
+    {
+        e = std::move(it->second);
+        maps_.erase(it);
+    }
+    return e;
+}
+
 runner::runner(config const & defaults,
-               std::size_t iterations,
-               runner::renderer_container const & renderers)
+               iteration_config const & iterations,
+               std::size_t jobs,
+               runner::renderer_container const & renderers,
+               std::shared_ptr<image_writer> const & writer,
+               std::shared_ptr<render_cache> const & cache,
+               std::shared_ptr<shard_config> const & shard,
+               std::shared_ptr<trace_log> const & trace)
     : defaults_(defaults),
       iterations_(iterations),
-      renderers_(renderers)
+      jobs_(jobs),
+      renderers_(renderers),
+      writer_(writer),
+      cache_(cache),
+      shard_(shard),
+      trace_(trace)
+{
+}
+
+result_list runner::test(std::vector<std::string> const & style_names, report_type & report)
 {
+    std::vector<std::string> selected(shard_ ? plan_shard(style_names) : style_names);
+
+    result_list results(jobs_ > 1 ?
+        test_parallel(selected, report) :
+        test_serial(selected, report));
+
+    if (cache_)
+    {
+        cache_->save();
+    }
+
+    return results;
 }
 
-result_list runner::test(std::vector<std::string> const & style_names, report_type & report) const
+result_list runner::test_serial(std::vector<std::string> const & style_names, report_type & report) const
 {
     result_list results;
 
@@ -137,11 +473,7 @@ result_list runner::test(std::vector<std::string> const & style_names, report_ty
         }
         catch (std::exception const& ex)
         {
-            result r;
-            r.state = STATE_ERROR;
-            r.name = style_name;
-            r.error_message = ex.what();
-            r.duration = std::chrono::high_resolution_clock::duration::zero();
+            result r(error_result(style_name, ex.what()));
             results.emplace_back(r);
             mapnik::util::apply_visitor(report_visitor(r), report);
         }
@@ -150,15 +482,110 @@ result_list runner::test(std::vector<std::string> const & style_names, report_ty
     return results;
 }
 
+result_list runner::test_parallel(std::vector<std::string> const & style_names, report_type & report) const
+{
+    // Every style gets its own slot and every job its own element within it,
+    // so workers never write to the same location and no locking is needed.
+    std::vector<result_list> style_results(style_names.size());
+    thread_pool pool(jobs_);
+    std::vector<worker_map> maps(pool.size());
+    for (auto & m : maps)
+    {
+        m.planned = &planned_maps_;
+    }
+    task_group group(pool);
+
+    for (std::size_t style_index = 0; style_index < style_names.size(); style_index++)
+    {
+        group.run([&, style_index](std::size_t worker)
+        {
+            std::string const & style_name = style_names[style_index];
+            result_list & results = style_results[style_index];
+            try
+            {
+                runner::path_type file(style_name);
+                trace_scope scope(trace_context_of(file.stem().string(), ""));
+                std::vector<job> jobs(shard_jobs(expand_jobs(file, maps[worker], true)));
+                results.resize(jobs.size());
+                for (std::size_t job_index = 0; job_index < jobs.size(); job_index++)
+                {
+                    job const j(jobs[job_index]);
+                    result * slot = &results[job_index];
+                    group.run([this, &maps, slot, j](std::size_t worker)
+                    {
+                        run(j, maps[worker], *slot);
+                    });
+                }
+            }
+            catch (std::exception const& ex)
+            {
+                results.assign(1, error_result(style_name, ex.what()));
+            }
+        });
+    }
+
+    group.wait();
+
+    if (writer_)
+    {
+        writer_->wait();
+    }
+
+    result_list results;
+    for (auto & style_result : style_results)
+    {
+        store(style_result);
+        for (auto & r : style_result)
+        {
+            mapnik::util::apply_visitor(report_visitor(r), report);
+            results.push_back(std::move(r));
+        }
+    }
+
+    return results;
+}
+
 result_list runner::test_one(runner::path_type const& style_path,
                              report_type & report) const
 {
-    config cfg(defaults_);
-    const map_size default_size(512, 512);
-    mapnik::Map map(default_size.width, default_size.height);
-    result_list results;
+    worker_map map;
+    map.planned = &planned_maps_;
+    std::vector<job> jobs;
+    {
+        trace_scope scope(trace_context_of(style_path.stem().string(), ""));
+        jobs = shard_jobs(expand_jobs(style_path, map, true));
+    }
+    // Results stay in place while background writer may update them.
+    result_list results(jobs.size());
 
-    mapnik::load_map(map, style_path.string(), true);
+    for (std::size_t i = 0; i < jobs.size(); i++)
+    {
+        run(jobs[i], map, results[i]);
+        if (!writer_)
+        {
+            mapnik::util::apply_visitor(report_visitor(results[i]), report);
+        }
+    }
+
+    if (writer_)
+    {
+        writer_->wait();
+        for (auto const & r : results)
+        {
+            mapnik::util::apply_visitor(report_visitor(r), report);
+        }
+    }
+
+    store(results);
+
+    return results;
+}
+
+std::vector<job> runner::create_jobs(runner::path_type const& style_path,
+                                     mapnik::Map const & map) const
+{
+    config cfg(defaults_);
+    std::vector<job> jobs;
 
     mapnik::parameters const & params = map.get_extra_parameters();
 
@@ -170,7 +597,7 @@ result_list runner::test_one(runner::path_type const& style_path,
         }
         else
         {
-            cfg.sizes.push_back(default_size);
+            cfg.sizes.push_back(worker_map::default_size);
         }
     }
 
@@ -197,12 +624,16 @@ result_list runner::test_one(runner::path_type const& style_path,
         }
     }
 
-    std::string name(style_path.stem().string());
+    job j;
+    j.style_path = style_path;
+    j.name = style_path.stem().string();
 
     for (auto const & size : cfg.sizes)
     {
+        j.size = size;
         for (auto const & scale_factor : cfg.scales)
         {
+            j.scale_factor = scale_factor;
             for (auto const & tiles_count : cfg.tiles)
             {
                 if (!tiles_count.width || !tiles_count.height)
@@ -214,24 +645,27 @@ result_list runner::test_one(runner::path_type const& style_path,
                     throw std::runtime_error("Tile size is not an integer.");
                 }
 
-                for (auto const & ren : renderers_)
+                j.tiles = tiles_count;
+                for (std::size_t renderer_index = 0; renderer_index < renderers_.size(); renderer_index++)
                 {
-                    map.resize(size.width * scale_factor, size.height * scale_factor);
-
-                    renderer_visitor visitor(name, map, tiles_count, scale_factor,
-                        results, report, iterations_);
+                    if ((tiles_count.width > 1 || tiles_count.height > 1) &&
+                        !mapnik::util::apply_visitor(support_tiles_visitor(), renderers_[renderer_index]))
+                    {
+                        continue;
+                    }
 
+                    j.renderer_index = renderer_index;
                     if (cfg.envelopes.empty())
                     {
-                        map.zoom_all();
-                        mapnik::util::apply_visitor(visitor, ren);
+                        j.envelope = boost::none;
+                        jobs.push_back(j);
                     }
                     else
                     {
                         for (auto const & box : cfg.envelopes)
                         {
-                            map.zoom_to_box(box);
-                            mapnik::util::apply_visitor(visitor, ren);
+                            j.envelope = box;
+                            jobs.push_back(j);
                         }
                     }
                 }
@@ -239,7 +673,341 @@ result_list runner::test_one(runner::path_type const& style_path,
         }
     }
 
-    return results;
+    return jobs;
+}
+
+// With render cache, jobs expanded by an earlier run of the unchanged style
+// are reused. The map is then not loaded at all when only the job list is
+// needed, or when results of all jobs this run renders are cached. The
+// first job of a loaded style carries its load time.
+std::vector<job> runner::expand_jobs(runner::path_type const & style_path,
+                                     worker_map & maps,
+                                     bool results_needed) const
+{
+    std::uint64_t style_hash = 0;
+    std::uint64_t key = 0;
+    if (cache_)
+    {
+        style_hash = cache_->style_hash(style_path);
+        key = jobs_key(style_path, style_hash);
+        if (boost::optional<std::vector<job>> jobs = cache_->find_jobs(key))
+        {
+            for (auto & j : *jobs)
+            {
+                j.style_path = style_path;
+                j.name = style_path.stem().string();
+                j.style_hash = style_hash;
+            }
+            std::vector<job> selected(shard_jobs(*jobs));
+            if (!results_needed ||
+                std::all_of(selected.begin(), selected.end(), [this](job const & j) { return cached(j); }))
+            {
+                return *jobs;
+            }
+        }
+    }
+
+    duration_type load_duration;
+    std::vector<job> jobs(create_jobs(style_path, maps.get(style_path, load_duration)));
+    for (auto & j : jobs)
+    {
+        j.style_hash = style_hash;
+    }
+    if (!jobs.empty())
+    {
+        jobs.front().load_map = load_duration;
+    }
+    if (cache_)
+    {
+        cache_->store_jobs(key, jobs);
+    }
+    return jobs;
+}
+
+// Everything job expansion depends on besides the style: sizes, scales,
+// tiles and envelopes given on command line and enabled renderers.
+std::uint64_t runner::jobs_key(runner::path_type const & style_path, std::uint64_t style_hash) const
+{
+    std::ostringstream s;
+    s << style_path.string() << '\n' << std::hex << style_hash << std::dec << '\n' << std::setprecision(17);
+    for (auto const & size : defaults_.sizes)
+    {
+        s << size.width << 'x' << size.height << ' ';
+    }
+    s << '\n';
+    for (auto const & scale : defaults_.scales)
+    {
+        s << scale << ' ';
+    }
+    s << '\n';
+    for (auto const & tiles : defaults_.tiles)
+    {
+        s << tiles.width << 'x' << tiles.height << ' ';
+    }
+    s << '\n';
+    for (auto const & box : defaults_.envelopes)
+    {
+        s << envelope_string(box) << ' ';
+    }
+    s << '\n';
+    for (auto const & ren : renderers_)
+    {
+        s << mapnik::util::apply_visitor(renderer_name_visitor(), ren) << ' ';
+    }
+    std::string text(s.str());
+    return checksum(text.data(), text.size());
+}
+
+bool runner::cached(job const & j) const
+{
+    renderer_type const & ren = renderers_[j.renderer_index];
+    boost::optional<result> r(cache_->find(cache_->key(j, mapnik::util::apply_visitor(renderer_name_visitor(), ren))));
+    return r && complete(*r, ren);
+}
+
+// Expands jobs of all styles on the thread pool and assigns them to shards
+// by their durations in the earlier run, jobs missing there are estimated
+// from their pixel count. Styles failing to load are reported by one shard
+// only. Maps loaded for planning are kept for styles of this shard. Returns
+// styles with work for this shard.
+std::vector<std::string> runner::plan_shard(std::vector<std::string> const & style_names)
+{
+    struct planned_style
+    {
+        std::vector<job> jobs;
+        worker_map maps;
+        bool failed = false;
+    };
+
+    std::vector<planned_style> planned(style_names.size());
+    {
+        thread_pool pool(jobs_);
+        task_group group(pool);
+        for (std::size_t style_index = 0; style_index < style_names.size(); style_index++)
+        {
+            group.run([&, style_index](std::size_t)
+            {
+                planned_style & style = planned[style_index];
+                try
+                {
+                    style.jobs = expand_jobs(runner::path_type(style_names[style_index]), style.maps, false);
+                }
+                catch (std::exception const &)
+                {
+                    style.failed = true;
+                }
+            });
+        }
+        group.wait();
+    }
+
+    shard_spec const & spec = shard_->spec;
+    std::vector<shard_item> items;
+    std::vector<std::size_t> item_styles;
+    std::vector<double> item_pixels;
+    std::vector<bool> known;
+    std::set<std::size_t> styles;
+    double known_cost = 0;
+    double known_pixels = 0;
+
+    for (std::size_t style_index = 0; style_index < style_names.size(); style_index++)
+    {
+        if (planned[style_index].failed)
+        {
+            if (style_index % spec.count == spec.index - 1)
+            {
+                styles.insert(style_index);
+            }
+            continue;
+        }
+
+        for (auto const & j : planned[style_index].jobs)
+        {
+            double pixels = j.size.width * j.scale_factor * j.size.height * j.scale_factor;
+            boost::optional<double> cost(shard_->costs.find(
+                j.name,
+                mapnik::util::apply_visitor(renderer_name_visitor(), renderers_[j.renderer_index]),
+                j.size, j.tiles, j.scale_factor, j.envelope));
+            if (cost)
+            {
+                known_cost += *cost;
+                known_pixels += pixels;
+            }
+            items.push_back({ job_key(j), cost ? *cost : 0.0 });
+            item_styles.push_back(style_index);
+            item_pixels.push_back(pixels);
+            known.push_back(static_cast<bool>(cost));
+        }
+    }
+
+    double pixel_cost = known_pixels > 0 ? known_cost / known_pixels : 1.0;
+    for (std::size_t i = 0; i < items.size(); i++)
+    {
+        if (!known[i])
+        {
+            items[i].cost = item_pixels[i] * pixel_cost;
+        }
+    }
+
+    std::vector<std::size_t> shards(assign_shards(items, spec.count));
+    for (std::size_t i = 0; i < items.size(); i++)
+    {
+        if (shards[i] == spec.index - 1)
+        {
+            shard_jobs_.insert(items[i].key);
+            styles.insert(item_styles[i]);
+        }
+    }
+    std::vector<std::string> selected;
+    for (std::size_t style_index : styles)
+    {
+        selected.push_back(style_names[style_index]);
+        planned_style & style = planned[style_index];
+        if (!style.maps.maps.empty())
+        {
+            loaded_maps::entry e;
+            e.map = std::move(style.maps.maps.front().second);
+            e.load_duration = style.jobs.empty() ? duration_type::zero() : style.jobs.front().load_map;
+            planned_maps_.put(style_names[style_index], std::move(e));
+        }
+    }
+    return selected;
+}
+
+std::vector<job> runner::shard_jobs(std::vector<job> jobs) const
+{
+    if (shard_)
+    {
+        jobs.erase(std::remove_if(jobs.begin(), jobs.end(), [this](job const & j)
+        {
+            return shard_jobs_.count(job_key(j)) == 0;
+        }), jobs.end());
+    }
+    return jobs;
+}
+
+std::string runner::job_key(job const & j) const
+{
+    // Style name rather than path, which may be spelled differently on
+    // other machines.
+    std::ostringstream s;
+    s << j.name << '/'
+      << mapnik::util::apply_visitor(renderer_name_visitor(), renderers_[j.renderer_index]) << '/'
+      << j.size.width << 'x' << j.size.height << '/'
+      << j.tiles.width << 'x' << j.tiles.height << '/'
+      << std::setprecision(17) << j.scale_factor;
+    if (j.envelope)
+    {
+        s << '/' << envelope_string(*j.envelope);
+    }
+    return s.str();
+}
+
+void runner::run(job const & j, worker_map & worker, result & r) const
+{
+    renderer_type const & ren = renderers_[j.renderer_index];
+    trace_scope scope(trace_context_of(j.name, mapnik::util::apply_visitor(renderer_name_visitor(), ren)));
+
+    try
+    {
+        boost::optional<std::uint64_t> cache_key;
+        if (cache_)
+        {
+            cache_key = cache_->key(j, mapnik::util::apply_visitor(renderer_name_visitor(), ren));
+            boost::optional<result> cached = cache_->find(*cache_key);
+            if (cached && complete(*cached, ren))
+            {
+                r = std::move(*cached);
+                r.cache_key = cache_key;
+                r.cached = true;
+                r.envelope = j.envelope;
+                return;
+            }
+        }
+
+        duration_type load_duration;
+        mapnik::Map & map = worker.get(j.style_path, load_duration);
+        phase_durations phases;
+        phases.load_map = j.load_map + load_duration;
+
+        std::chrono::high_resolution_clock::time_point start(std::chrono::high_resolution_clock::now());
+        {
+            trace_span span("zoom");
+            map.resize(j.size.width * j.scale_factor, j.size.height * j.scale_factor);
+
+            if (j.envelope)
+            {
+                map.zoom_to_box(*j.envelope);
+            }
+            else
+            {
+                map.zoom_all();
+            }
+        }
+        phases.zoom = std::chrono::high_resolution_clock::now() - start;
+
+        renderer_visitor visitor(j.name, map, j.tiles, j.scale_factor, iterations_, phases, r);
+        mapnik::util::apply_visitor(visitor, ren);
+        r.cache_key = cache_key;
+        r.envelope = j.envelope;
+    }
+    catch (std::exception const& ex)
+    {
+        r = error_result(j.name, ex.what());
+        r.renderer_name = mapnik::util::apply_visitor(renderer_name_visitor(), ren);
+        r.size = j.size;
+        r.tiles = j.tiles;
+        r.scale_factor = j.scale_factor;
+        r.envelope = j.envelope;
+    }
+}
+
+std::shared_ptr<trace_context const> runner::trace_context_of(std::string const & style,
+                                                              std::string const & renderer) const
+{
+    if (!trace_)
+    {
+        return nullptr;
+    }
+    return std::make_shared<trace_context const>(trace_context { *trace_, style, renderer });
+}
+
+// Render cache keeps neither memory, CPU, parallelizer nor tile comparison
+// measurements, its results are not used when the run asks for them.
+bool runner::complete(result const & r, renderer_type const & ren) const
+{
+    return (!iterations_.memory || r.memory) &&
+           (!iterations_.cpu || r.cpu) &&
+           (r.parallelizer || !mapnik::util::apply_visitor(parallelizer_compare_visitor(), ren)) &&
+           (r.tile_pool || !mapnik::util::apply_visitor(tile_compare_visitor(r.tiles), ren));
+}
+
+void runner::store(result_list const & results) const
+{
+    if (!cache_)
+    {
+        return;
+    }
+
+    for (auto const & r : results)
+    {
+        if (r.cache_key && !r.cached && r.state != STATE_ERROR)
+        {
+            cache_->store(*r.cache_key, r);
+        }
+    }
+}
+
+result runner::error_result(std::string const & name, std::string const & message) const
+{
+    result r;
+    r.state = STATE_ERROR;
+    r.name = name;
+    r.error_message = message;
+    r.scale_factor = 0;
+    r.duration = std::chrono::high_resolution_clock::duration::zero();
+    r.tiles_duration = std::chrono::high_resolution_clock::duration::zero();
+    return r;
 }
 
 }
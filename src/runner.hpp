@@ -23,14 +23,45 @@
 #ifndef MAPNIK_RENDER_RUNNER_HPP
 #define MAPNIK_RENDER_RUNNER_HPP
 
+#include <set>
+#include <map>
+#include <mutex>
+#include <memory>
+
 #include "config.hpp"
 #include "report.hpp"
 #include "renderer.hpp"
 #include "map_sizes_grammar.hpp"
+#include "render_cache.hpp"
+#include "shard.hpp"
+#include "trace.hpp"
 
 namespace mapnik_render
 {
 
+struct worker_map;
+
+// Maps loaded while planning a shard, each taken by the first worker which
+// renders its style instead of loading it again.
+class loaded_maps
+{
+public:
+    struct entry
+    {
+        std::unique_ptr<mapnik::Map> map;
+        duration_type load_duration;
+    };
+
+    void put(boost::filesystem::path const & style_path, entry e);
+
+    // Returns entry with null map when style was not loaded.
+    entry take(boost::filesystem::path const & style_path);
+
+private:
+    std::mutex mutex_;
+    std::map<std::string, entry> maps_;
+};
+
 class runner
 {
     using path_type = boost::filesystem::path;
@@ -41,22 +72,89 @@ public:
 
     runner(
         config const & cfg,
-        std::size_t iterations,
-        renderer_container const & renderers);
+        iteration_config const & iterations,
+        std::size_t jobs,
+        renderer_container const & renderers,
+        std::shared_ptr<image_writer> const & writer = nullptr,
+        std::shared_ptr<render_cache> const & cache = nullptr,
+        std::shared_ptr<shard_config> const & shard = nullptr,
+        std::shared_ptr<trace_log> const & trace = nullptr);
 
+    // With shard config, only jobs assigned to the shard are run.
     result_list test(
         std::vector<std::string> const & style_names,
-        report_type & report) const;
+        report_type & report);
 
 private:
+    std::vector<std::string> plan_shard(
+        std::vector<std::string> const & style_names);
+
+    std::vector<job> shard_jobs(
+        std::vector<job> jobs) const;
+
+    std::string job_key(
+        job const & j) const;
+
+    result_list test_serial(
+        std::vector<std::string> const & style_names,
+        report_type & report) const;
+
+    result_list test_parallel(
+        std::vector<std::string> const & style_names,
+        report_type & report) const;
+
     result_list test_one(
         path_type const & style_path,
         report_type & report) const;
 
+    std::vector<job> create_jobs(
+        path_type const & style_path,
+        mapnik::Map const & map) const;
+
+    std::vector<job> expand_jobs(
+        path_type const & style_path,
+        worker_map & maps,
+        bool results_needed) const;
+
+    std::uint64_t jobs_key(
+        path_type const & style_path,
+        std::uint64_t style_hash) const;
+
+    bool cached(
+        job const & j) const;
+
+    void run(
+        job const & j,
+        worker_map & worker,
+        result & r) const;
+
+    void store(result_list const & results) const;
+
+    bool complete(
+        result const & r,
+        renderer_type const & ren) const;
+
+    // Context of trace spans of a job, null when not tracing.
+    std::shared_ptr<trace_context const> trace_context_of(
+        std::string const & style,
+        std::string const & renderer) const;
+
+    result error_result(
+        std::string const & name,
+        std::string const & message) const;
+
     const map_sizes_grammar<std::string::const_iterator> map_sizes_parser_;
     const config defaults_;
-    const std::size_t iterations_;
+    const iteration_config iterations_;
+    const std::size_t jobs_;
     const renderer_container renderers_;
+    const std::shared_ptr<image_writer> writer_;
+    const std::shared_ptr<render_cache> cache_;
+    const std::shared_ptr<shard_config> shard_;
+    const std::shared_ptr<trace_log> trace_;
+    // Keys of jobs assigned to this shard.
+    std::set<std::string> shard_jobs_;
+    mutable loaded_maps planned_maps_;
 };
 
 }
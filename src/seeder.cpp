@@ -0,0 +1,346 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <stdexcept>
+
+#include <mapnik/map.hpp>
+#include <mapnik/load_map.hpp>
+#include <mapnik/well_known_srs.hpp>
+
+#include "seeder.hpp"
+#include "thread_pool.hpp"
+
+namespace mapnik_render
+{
+
+namespace
+{
+
+std::size_t tile_pixels(seed_config const & cfg)
+{
+    return static_cast<std::size_t>(std::lround(cfg.tile_size * cfg.scale_factor));
+}
+
+class seed_visitor
+{
+public:
+    seed_visitor(std::string const & name,
+                 mapnik::Map & map,
+                 seed_config const & cfg,
+                 metatile const & meta,
+                 seed_result & r)
+        : name_(name),
+          map_(map),
+          cfg_(cfg),
+          meta_(meta),
+          result_(r)
+    {
+    }
+
+    template <typename T, typename std::enable_if<T::renderer_type::support_tiles>::type* = nullptr>
+    void operator()(T const & renderer) const
+    {
+        typename T::image_type image(renderer.render(map_, cfg_.scale_factor));
+        std::size_t size = tile_pixels(cfg_);
+
+        // Every tile counts either as saved or as an error, so a failing
+        // tile does not take the rest of the metatile with it.
+        for (std::size_t y = meta_.min_y; y <= meta_.max_y; y++)
+        {
+            for (std::size_t x = meta_.min_x; x <= meta_.max_x; x++)
+            {
+                try
+                {
+                    typename T::image_type tile(renderer.create(size, size));
+                    get_rectangle(image, tile,
+                                  cfg_.buffer + (x - meta_.min_x) * size,
+                                  cfg_.buffer + (y - meta_.min_y) * size);
+                    result r(renderer.tile_report(name_, meta_.zoom, x, y, map_size(size, size), cfg_.scale_factor));
+                    renderer.save(std::move(tile), r);
+                    if (r.state != STATE_OK)
+                    {
+                        result_.errors++;
+                        result_.error_message = r.error_message;
+                        continue;
+                    }
+                    result_.tiles++;
+                }
+                catch (std::exception const & ex)
+                {
+                    result_.errors++;
+                    result_.error_message = ex.what();
+                }
+            }
+        }
+
+        renderer.recycle(std::move(image));
+    }
+
+    template <typename T, typename std::enable_if<!T::renderer_type::support_tiles>::type* = nullptr>
+    void operator()(T const &) const
+    {
+        throw std::runtime_error(std::string("Renderer ") + T::renderer_type::name + " does not produce raster tiles.");
+    }
+
+private:
+    std::string const & name_;
+    mapnik::Map & map_;
+    seed_config const & cfg_;
+    metatile const & meta_;
+    seed_result & result_;
+};
+
+struct support_tiles_visitor
+{
+    template <typename T>
+    bool operator()(T const &) const
+    {
+        return T::renderer_type::support_tiles;
+    }
+};
+
+struct renderer_name_visitor
+{
+    template <typename T>
+    std::string operator()(T const &) const
+    {
+        return T::renderer_type::name;
+    }
+};
+
+}
+
+std::uint64_t hilbert_index(std::uint64_t n, std::uint64_t x, std::uint64_t y)
+{
+    std::uint64_t d = 0;
+    for (std::uint64_t s = n / 2; s > 0; s /= 2)
+    {
+        std::uint64_t rx = (x & s) > 0;
+        std::uint64_t ry = (y & s) > 0;
+        d += s * s * ((3 * rx) ^ ry);
+        // Rotate quadrant so the curve inside it has the canonical orientation.
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+std::vector<metatile> metatiles(seed_config const & cfg)
+{
+    mapnik::box2d<double> world(-mercator_extent, -mercator_extent, mercator_extent, mercator_extent);
+    mapnik::box2d<double> envelope(cfg.envelope.valid() && cfg.envelope.intersects(world) ?
+        cfg.envelope.intersect(world) : world);
+    std::size_t meta = std::max<std::size_t>(cfg.metatile, 1);
+
+    std::vector<metatile> result;
+
+    for (unsigned zoom = cfg.min_zoom; zoom <= cfg.max_zoom; zoom++)
+    {
+        std::size_t count = std::size_t(1) << zoom;
+        double tile_extent = 2 * mercator_extent / count;
+        auto tile_index = [count](double value)
+        {
+            return static_cast<std::size_t>(std::min<double>(std::max(value, 0.0), count - 1));
+        };
+
+        std::size_t min_x = tile_index(std::floor((envelope.minx() + mercator_extent) / tile_extent));
+        std::size_t max_x = tile_index(std::ceil((envelope.maxx() + mercator_extent) / tile_extent) - 1);
+        std::size_t min_y = tile_index(std::floor((mercator_extent - envelope.maxy()) / tile_extent));
+        std::size_t max_y = tile_index(std::ceil((mercator_extent - envelope.miny()) / tile_extent) - 1);
+
+        std::size_t meta_min_x = min_x / meta;
+        std::size_t meta_min_y = min_y / meta;
+        std::size_t columns = max_x / meta - meta_min_x + 1;
+        std::size_t rows = max_y / meta - meta_min_y + 1;
+        std::uint64_t side = 1;
+        while (side < std::max(columns, rows))
+        {
+            side *= 2;
+        }
+
+        std::vector<std::pair<std::uint64_t, metatile>> level;
+        level.reserve(columns * rows);
+        for (std::size_t row = 0; row < rows; row++)
+        {
+            for (std::size_t column = 0; column < columns; column++)
+            {
+                std::size_t mx = meta_min_x + column;
+                std::size_t my = meta_min_y + row;
+                metatile m;
+                m.zoom = zoom;
+                m.min_x = std::max(mx * meta, min_x);
+                m.min_y = std::max(my * meta, min_y);
+                m.max_x = std::min(mx * meta + meta - 1, max_x);
+                m.max_y = std::min(my * meta + meta - 1, max_y);
+                level.emplace_back(hilbert_index(side, column, row), m);
+            }
+        }
+
+        std::sort(level.begin(), level.end(),
+            [](std::pair<std::uint64_t, metatile> const & a, std::pair<std::uint64_t, metatile> const & b)
+            {
+                return a.first < b.first;
+            });
+
+        for (auto const & item : level)
+        {
+            result.push_back(item.second);
+        }
+    }
+
+    return result;
+}
+
+seeder::seeder(seed_config const & cfg,
+               std::size_t jobs,
+               renderer_container const & renderers)
+    : cfg_(cfg),
+      jobs_(std::max<std::size_t>(jobs, 1)),
+      renderers_(renderers)
+{
+}
+
+std::vector<seed_result> seeder::seed(std::vector<std::string> const & style_names) const
+{
+    std::vector<metatile> work(metatiles(cfg_));
+    std::vector<seed_result> results;
+
+    for (auto const & style_name : style_names)
+    {
+        for (auto const & ren : renderers_)
+        {
+            // Only raster renderers can be cut into tiles.
+            if (!mapnik::util::apply_visitor(support_tiles_visitor(), ren))
+            {
+                continue;
+            }
+            results.push_back(seed(style_name, ren, work));
+        }
+    }
+
+    return results;
+}
+
+seed_result seeder::seed(boost::filesystem::path const & style_path,
+                         renderer_type const & renderer,
+                         std::vector<metatile> const & work) const
+{
+    std::string name(style_path.stem().string());
+    std::size_t size = tile_pixels(cfg_);
+    std::chrono::high_resolution_clock::time_point start(std::chrono::high_resolution_clock::now());
+
+    seed_result total;
+    total.name = name;
+    total.renderer_name = mapnik::util::apply_visitor(renderer_name_visitor(), renderer);
+
+    // The style is loaded and checked once, a broken style is one error.
+    mapnik::Map style;
+    try
+    {
+        mapnik::load_map(style, style_path.string(), true);
+        boost::optional<mapnik::well_known_srs_e> srs(mapnik::is_well_known_srs(style.srs()));
+        if (!srs || *srs != mapnik::G_MERC)
+        {
+            throw std::runtime_error("Map projection is not EPSG:3857: " + style.srs());
+        }
+    }
+    catch (std::exception const & ex)
+    {
+        total.errors = 1;
+        total.error_message = ex.what();
+        total.duration = std::chrono::high_resolution_clock::now() - start;
+        return total;
+    }
+
+    // Workers take metatiles in Hilbert order from a shared counter, results
+    // are collected per worker and merged at the end.
+    std::vector<seed_result> partial(jobs_);
+    std::atomic<std::size_t> next(0);
+    {
+        thread_pool pool(jobs_);
+        task_group group(pool);
+        for (std::size_t i = 0; i < jobs_; i++)
+        {
+            group.run([&, i](std::size_t)
+            {
+                seed_result & r = partial[i];
+                mapnik::Map map(style);
+
+                for (std::size_t index = next++; index < work.size(); index = next++)
+                {
+                    metatile const & meta = work[index];
+                    double tile_extent = 2 * mercator_extent / (std::size_t(1) << meta.zoom);
+                    double buffer = cfg_.buffer * tile_extent / size;
+                    mapnik::box2d<double> box(
+                        -mercator_extent + meta.min_x * tile_extent - buffer,
+                        mercator_extent - (meta.max_y + 1) * tile_extent - buffer,
+                        -mercator_extent + (meta.max_x + 1) * tile_extent + buffer,
+                        mercator_extent - meta.min_y * tile_extent + buffer);
+                    std::size_t count = (meta.max_x - meta.min_x + 1) * (meta.max_y - meta.min_y + 1);
+                    std::size_t before = r.tiles + r.errors;
+                    try
+                    {
+                        map.resize((meta.max_x - meta.min_x + 1) * size + 2 * cfg_.buffer,
+                                   (meta.max_y - meta.min_y + 1) * size + 2 * cfg_.buffer);
+                        map.zoom_to_box(box);
+                        mapnik::util::apply_visitor(seed_visitor(name, map, cfg_, meta, r), renderer);
+                    }
+                    catch (std::exception const & ex)
+                    {
+                        // Tiles not accounted for yet failed with the metatile.
+                        std::size_t accounted = r.tiles + r.errors - before;
+                        r.errors += count > accounted ? count - accounted : 0;
+                        r.error_message = ex.what();
+                    }
+                    r.metatiles++;
+                }
+            });
+        }
+        group.wait();
+    }
+
+    for (auto const & r : partial)
+    {
+        total.metatiles += r.metatiles;
+        total.tiles += r.tiles;
+        total.errors += r.errors;
+        if (!r.error_message.empty())
+        {
+            total.error_message = r.error_message;
+        }
+    }
+    total.duration = std::chrono::high_resolution_clock::now() - start;
+    return total;
+}
+
+}
@@ -0,0 +1,112 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#ifndef MAPNIK_RENDER_SEEDER_HPP
+#define MAPNIK_RENDER_SEEDER_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <mapnik/box2d.hpp>
+
+#include "config.hpp"
+#include "renderer.hpp"
+
+namespace mapnik_render
+{
+
+struct seed_config
+{
+    unsigned min_zoom = 0;
+    unsigned max_zoom = 0;
+    // Area to seed in spherical mercator coordinates.
+    mapnik::box2d<double> envelope;
+    // Tiles per side of a metatile.
+    std::size_t metatile = 8;
+    // Pixels rendered around a metatile and thrown away, keeps labels and
+    // symbols crossing metatile edges consistent.
+    std::size_t buffer = 128;
+    std::size_t tile_size = 256;
+    double scale_factor = 1.0;
+};
+
+// Outcome of seeding one style with one renderer.
+struct seed_result
+{
+    std::string name;
+    std::string renderer_name;
+    std::size_t metatiles = 0;
+    std::size_t tiles = 0;
+    std::size_t errors = 0;
+    std::string error_message;
+    duration_type duration = duration_type::zero();
+};
+
+// Metatile of one zoom level, tile coordinates of its corners are inclusive.
+struct metatile
+{
+    unsigned zoom;
+    std::size_t min_x;
+    std::size_t min_y;
+    std::size_t max_x;
+    std::size_t max_y;
+};
+
+// Half of the extent of spherical mercator.
+constexpr double mercator_extent = 20037508.342789244;
+
+// Metatiles covering envelope on zoom levels of cfg, every level visited
+// along a Hilbert curve so consecutive metatiles are close to each other.
+std::vector<metatile> metatiles(seed_config const & cfg);
+
+// Index of x, y along Hilbert curve filling square of side n, a power of two.
+std::uint64_t hilbert_index(std::uint64_t n, std::uint64_t x, std::uint64_t y);
+
+// Renders XYZ tile pyramid: every metatile once, cut into tiles saved as
+// output_dir/style/z/x/y.ext by the renderer's sink. Metatiles are taken
+// in order by jobs workers, each with its own copy of the map.
+class seeder
+{
+public:
+    using renderer_container = std::vector<renderer_type>;
+
+    seeder(seed_config const & cfg,
+           std::size_t jobs,
+           renderer_container const & renderers);
+
+    std::vector<seed_result> seed(std::vector<std::string> const & style_names) const;
+
+private:
+    seed_result seed(boost::filesystem::path const & style_path,
+                     renderer_type const & renderer,
+                     std::vector<metatile> const & work) const;
+
+    const seed_config cfg_;
+    const std::size_t jobs_;
+    const renderer_container renderers_;
+};
+
+}
+
+#endif
@@ -0,0 +1,311 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#include <algorithm>
+#include <numeric>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+#include "shard.hpp"
+#include "report.hpp"
+
+namespace mapnik_render
+{
+
+namespace {
+
+using ptree = boost::property_tree::ptree;
+
+ptree const & read_report(boost::filesystem::path const & file, ptree & tree)
+{
+    try
+    {
+        boost::property_tree::read_json(file.string(), tree);
+    }
+    catch (boost::property_tree::json_parser_error const & ex)
+    {
+        throw std::runtime_error("Cannot read report " + file.string() + ": " + ex.message());
+    }
+
+    boost::optional<ptree &> results(tree.get_child_optional("results"));
+    if (!results)
+    {
+        throw std::runtime_error(file.string() + " is not a JSON report");
+    }
+    return *results;
+}
+
+duration_type nanoseconds(ptree const & tree, std::string const & path)
+{
+    return std::chrono::duration_cast<duration_type>(
+        std::chrono::nanoseconds(tree.get<std::int64_t>(path, 0)));
+}
+
+// Object member which is not null.
+boost::optional<ptree const &> object(ptree const & tree, std::string const & path)
+{
+    boost::optional<ptree const &> child(tree.get_child_optional(path));
+    if (!child || child->empty())
+    {
+        return boost::none;
+    }
+    return child;
+}
+
+// Envelope of a result, none when it is null.
+boost::optional<mapnik::box2d<double>> read_envelope(ptree const & tree)
+{
+    std::string text(tree.get<std::string>("envelope", "null"));
+    mapnik::box2d<double> box;
+    if (text == "null" || !box.from_string(text))
+    {
+        return boost::none;
+    }
+    return box;
+}
+
+result_state parse_state(std::string const & state)
+{
+    if (state == "ok")
+    {
+        return STATE_OK;
+    }
+    if (state == "fail")
+    {
+        return STATE_FAIL;
+    }
+    return STATE_ERROR;
+}
+
+}
+
+shard_spec shard_spec::parse(std::string const & text)
+{
+    shard_spec spec;
+    char slash = 0;
+    std::istringstream s(text);
+    if (!(s >> spec.index >> slash >> spec.count) || slash != '/' || !s.eof() ||
+        spec.count == 0 || spec.index == 0 || spec.index > spec.count)
+    {
+        throw std::runtime_error("Invalid shard, expected i/N with 1 <= i <= N: " + text);
+    }
+    return spec;
+}
+
+job_costs::job_costs(boost::filesystem::path const & report_file)
+{
+    ptree tree;
+    for (auto const & item : read_report(report_file, tree))
+    {
+        ptree const & r = item.second;
+        if (r.get<std::string>("state", "") == "error" || r.get<bool>("cached", false))
+        {
+            continue;
+        }
+        duration_type median(nanoseconds(r, "statistics_ns.median"));
+        if (median.count() <= 0)
+        {
+            continue;
+        }
+        std::string k(key(r.get<std::string>("name", ""),
+                          r.get<std::string>("renderer", ""),
+                          map_size(r.get<std::size_t>("width", 0), r.get<std::size_t>("height", 0)),
+                          map_size(r.get<std::size_t>("tiles_x", 1), r.get<std::size_t>("tiles_y", 1)),
+                          r.get<double>("scale_factor", 1.0),
+                          read_envelope(r)));
+        // Every iteration of the job costs about the median.
+        std::size_t iterations = std::max<std::size_t>(r.get_child("samples_ns", ptree()).size(), 1);
+        seconds_[k] += std::chrono::duration<double>(median).count() * iterations;
+    }
+}
+
+boost::optional<double> job_costs::find(std::string const & name,
+                                        std::string const & renderer_name,
+                                        map_size const & size,
+                                        map_size const & tiles,
+                                        double scale_factor,
+                                        boost::optional<mapnik::box2d<double>> const & envelope) const
+{
+    auto it = seconds_.find(key(name, renderer_name, size, tiles, scale_factor, envelope));
+    if (it == seconds_.end())
+    {
+        return boost::none;
+    }
+    return it->second;
+}
+
+std::string job_costs::key(std::string const & name,
+                           std::string const & renderer_name,
+                           map_size const & size,
+                           map_size const & tiles,
+                           double scale_factor,
+                           boost::optional<mapnik::box2d<double>> const & envelope)
+{
+    std::ostringstream s;
+    s << name << '/' << renderer_name << '/' << size.width << 'x' << size.height << '/'
+      << tiles.width << 'x' << tiles.height << '/' << std::setprecision(17) << scale_factor;
+    if (envelope)
+    {
+        s << '/' << envelope_string(*envelope);
+    }
+    return s.str();
+}
+
+std::vector<std::size_t> assign_shards(std::vector<shard_item> const & items, std::size_t count)
+{
+    std::vector<std::size_t> order(items.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&items](std::size_t a, std::size_t b)
+    {
+        if (items[a].cost != items[b].cost)
+        {
+            return items[a].cost > items[b].cost;
+        }
+        return items[a].key < items[b].key;
+    });
+
+    std::vector<double> loads(count, 0.0);
+    std::vector<std::size_t> shards(items.size());
+    for (std::size_t item : order)
+    {
+        std::size_t shard = std::min_element(loads.begin(), loads.end()) - loads.begin();
+        loads[shard] += items[item].cost;
+        shards[item] = shard;
+    }
+    return shards;
+}
+
+result_list read_json_results(boost::filesystem::path const & report_file)
+{
+    ptree tree;
+    result_list results;
+
+    for (auto const & item : read_report(report_file, tree))
+    {
+        ptree const & r = item.second;
+        result res;
+
+        res.name = r.get<std::string>("name", "");
+        res.state = parse_state(r.get<std::string>("state", ""));
+        res.renderer_name = r.get<std::string>("renderer", "");
+        res.size = map_size(r.get<std::size_t>("width", 0), r.get<std::size_t>("height", 0));
+        res.tiles = map_size(r.get<std::size_t>("tiles_x", 1), r.get<std::size_t>("tiles_y", 1));
+        res.scale_factor = r.get<double>("scale_factor", 1.0);
+        res.envelope = read_envelope(r);
+        res.image_path = r.get<std::string>("image_path", "");
+        res.error_message = r.get<std::string>("error", "");
+        res.duration = nanoseconds(r, "duration_ns");
+        if (boost::optional<ptree const &> samples = r.get_child_optional("samples_ns"))
+        {
+            for (auto const & value : *samples)
+            {
+                res.samples.emplace_back(std::chrono::duration_cast<duration_type>(
+                    std::chrono::nanoseconds(value.second.get_value<std::int64_t>())));
+            }
+        }
+        res.statistics.min = nanoseconds(r, "statistics_ns.min");
+        res.statistics.max = nanoseconds(r, "statistics_ns.max");
+        res.statistics.median = nanoseconds(r, "statistics_ns.median");
+        res.statistics.mean = nanoseconds(r, "statistics_ns.mean");
+        res.statistics.p95 = nanoseconds(r, "statistics_ns.p95");
+        res.statistics.p99 = nanoseconds(r, "statistics_ns.p99");
+        res.statistics.stddev = nanoseconds(r, "statistics_ns.stddev");
+        res.tiles_duration = nanoseconds(r, "tiles_duration_ns");
+
+        res.phases.load_map = nanoseconds(r, "phases_ns.load_map");
+        res.phases.zoom = nanoseconds(r, "phases_ns.zoom");
+        res.phases.render = nanoseconds(r, "phases_ns.render");
+        res.phases.encode = nanoseconds(r, "phases_ns.encode");
+        res.phases.write = nanoseconds(r, "phases_ns.write");
+
+        std::string checksum(r.get<std::string>("checksum", "null"));
+        if (checksum != "null")
+        {
+            res.checksum = std::stoull(checksum, nullptr, 16);
+        }
+        std::string mismatched_pixels(r.get<std::string>("mismatched_pixels", "null"));
+        if (mismatched_pixels != "null")
+        {
+            res.mismatched_pixels = std::stoull(mismatched_pixels);
+        }
+        res.cached = r.get<bool>("cached", false);
+
+        if (boost::optional<ptree const &> memory = object(r, "memory"))
+        {
+            memory_usage usage;
+            usage.allocations = memory->get<std::uint64_t>("allocations", 0);
+            usage.bytes = memory->get<std::uint64_t>("bytes", 0);
+            usage.peak_heap = memory->get<std::uint64_t>("peak_heap", 0);
+            usage.rss = memory->get<std::uint64_t>("rss", 0);
+            usage.peak_rss = memory->get<std::uint64_t>("peak_rss", 0);
+            res.memory = usage;
+        }
+
+        if (boost::optional<ptree const &> cpu = object(r, "cpu"))
+        {
+            cpu_usage usage;
+            usage.cycles = cpu->get_optional<std::uint64_t>("cycles");
+            usage.instructions = cpu->get_optional<std::uint64_t>("instructions");
+            usage.cache_misses = cpu->get_optional<std::uint64_t>("cache_misses");
+            usage.branch_misses = cpu->get_optional<std::uint64_t>("branch_misses");
+            usage.cpu_time = nanoseconds(*cpu, "cpu_time_ns");
+            usage.user_time = nanoseconds(*cpu, "user_time_ns");
+            usage.system_time = nanoseconds(*cpu, "system_time_ns");
+            usage.voluntary_switches = cpu->get<std::uint64_t>("voluntary_switches", 0);
+            usage.involuntary_switches = cpu->get<std::uint64_t>("involuntary_switches", 0);
+            res.cpu = usage;
+        }
+
+        if (boost::optional<ptree const &> parallelizer = object(r, "parallelizer"))
+        {
+            parallelizer_comparison comparison;
+            comparison.serial = nanoseconds(*parallelizer, "serial_ns");
+            comparison.parallel = nanoseconds(*parallelizer, "parallel_ns");
+            comparison.threads = parallelizer->get<std::size_t>("threads", 0);
+            comparison.speedup = parallelizer->get<double>("speedup", 0);
+            comparison.efficiency = parallelizer->get<double>("efficiency", 0);
+            comparison.mismatched_pixels = parallelizer->get<std::size_t>("mismatched_pixels", 0);
+            res.parallelizer = comparison;
+        }
+
+        if (boost::optional<ptree const &> tile_pool = object(r, "tile_pool"))
+        {
+            tile_comparison comparison;
+            comparison.serial = nanoseconds(*tile_pool, "serial_ns");
+            comparison.concurrent = nanoseconds(*tile_pool, "concurrent_ns");
+            comparison.threads = tile_pool->get<std::size_t>("threads", 0);
+            comparison.speedup = tile_pool->get<double>("speedup", 0);
+            res.tile_pool = comparison;
+        }
+
+        results.push_back(std::move(res));
+    }
+
+    return results;
+}
+
+}
@@ -0,0 +1,101 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#ifndef MAPNIK_RENDER_SHARD_HPP
+#define MAPNIK_RENDER_SHARD_HPP
+
+#include <string>
+#include <map>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/optional.hpp>
+
+#include "config.hpp"
+
+namespace mapnik_render
+{
+
+// Part index of count equal parts of a run, written as index/count with
+// index starting at 1.
+struct shard_spec
+{
+    std::size_t index = 1;
+    std::size_t count = 1;
+
+    static shard_spec parse(std::string const & text);
+};
+
+// Median durations of an earlier run read from its JSON report, keyed by
+// style name, renderer, size, tiles, scale factor and envelope.
+class job_costs
+{
+public:
+    job_costs() = default;
+    explicit job_costs(boost::filesystem::path const & report_file);
+
+    boost::optional<double> find(std::string const & name,
+                                 std::string const & renderer_name,
+                                 map_size const & size,
+                                 map_size const & tiles,
+                                 double scale_factor,
+                                 boost::optional<mapnik::box2d<double>> const & envelope) const;
+
+    std::size_t size() const { return seconds_.size(); }
+
+private:
+    static std::string key(std::string const & name,
+                           std::string const & renderer_name,
+                           map_size const & size,
+                           map_size const & tiles,
+                           double scale_factor,
+                           boost::optional<mapnik::box2d<double>> const & envelope);
+
+    std::map<std::string, double> seconds_;
+};
+
+struct shard_config
+{
+    shard_spec spec;
+    job_costs costs;
+};
+
+// Job to be placed on a shard, key identifies it the same way on every machine.
+struct shard_item
+{
+    std::string key;
+    double cost;
+};
+
+// Assigns items to count shards, most expensive first, each to the shard
+// with least total cost so far. Ties are broken by key and shard number, so
+// the same items give the same assignment regardless of their order.
+// Returns zero based shard of every item.
+std::vector<std::size_t> assign_shards(std::vector<shard_item> const & items, std::size_t count);
+
+// Results stored in a JSON report, for merging reports of shards.
+result_list read_json_results(boost::filesystem::path const & report_file);
+
+}
+
+#endif
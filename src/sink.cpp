@@ -0,0 +1,194 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#include <fstream>
+#include <cstring>
+
+#include "sink.hpp"
+
+namespace mapnik_render
+{
+
+constexpr const char * file_sink::name;
+constexpr const char * null_sink::name;
+constexpr const char * memory_sink::name;
+constexpr const char * checksum_sink::name;
+
+void file_sink::write(std::string const & data, result & res) const
+{
+    trace_span span("write");
+    std::chrono::high_resolution_clock::time_point start(std::chrono::high_resolution_clock::now());
+    boost::filesystem::path const & path = res.image_path;
+    if (path.has_parent_path())
+    {
+        boost::filesystem::create_directories(path.parent_path());
+    }
+    std::ofstream file(path.string().c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!file)
+    {
+        throw std::runtime_error("Cannot open file for writing: " + path.string());
+    }
+    file << data;
+    res.phases.write += std::chrono::high_resolution_clock::now() - start;
+}
+
+// Output is already in a file next to its destination, renaming it is enough.
+void file_sink::write(spooled_output const & output, result & res) const
+{
+    trace_span span("write");
+    std::chrono::high_resolution_clock::time_point start(std::chrono::high_resolution_clock::now());
+    output.commit(res.image_path);
+    res.phases.write += std::chrono::high_resolution_clock::now() - start;
+}
+
+memory_sink::memory_sink(std::size_t capacity)
+    : storage_(std::make_shared<storage>(capacity))
+{
+}
+
+std::string memory_sink::storage::erase(std::map<std::string, image>::iterator it)
+{
+    std::string data(std::move(it->second.data));
+    bytes -= data.size();
+    order.erase(it->second.position);
+    images.erase(it);
+    return data;
+}
+
+void memory_sink::write(std::string data, result & res) const
+{
+    std::string path(res.image_path.string());
+    std::lock_guard<std::mutex> lock(storage_->mutex);
+    auto it = storage_->images.find(path);
+    if (it != storage_->images.end())
+    {
+        storage_->erase(it);
+    }
+    storage_->bytes += data.size();
+    storage_->order.push_back(path);
+    image & stored = storage_->images[path];
+    stored.data = std::move(data);
+    stored.position = std::prev(storage_->order.end());
+
+    while (storage_->bytes > storage_->capacity)
+    {
+        storage_->erase(storage_->images.find(storage_->order.front()));
+    }
+}
+
+void memory_sink::write(spooled_output const & output, result & res) const
+{
+    write(output.read(), res);
+}
+
+boost::optional<std::string> memory_sink::take(boost::filesystem::path const & path) const
+{
+    std::lock_guard<std::mutex> lock(storage_->mutex);
+    auto it = storage_->images.find(path.string());
+    if (it == storage_->images.end())
+    {
+        return boost::none;
+    }
+    return storage_->erase(it);
+}
+
+void checksum_sink::write(void const * data, std::size_t size, result & res) const
+{
+    res.checksum = checksum(data, size);
+}
+
+void checksum_sink::write(spooled_output const & output, result & res) const
+{
+    res.checksum = output.checksum();
+}
+
+sink_type create_sink(std::string const & name, std::size_t memory_capacity)
+{
+    if (name == file_sink::name)
+    {
+        return file_sink();
+    }
+    if (name == null_sink::name)
+    {
+        return null_sink();
+    }
+    if (name == memory_sink::name)
+    {
+        return memory_sink(memory_capacity);
+    }
+    if (name == checksum_sink::name)
+    {
+        return checksum_sink();
+    }
+    throw std::runtime_error("Unknown output sink: " + name);
+}
+
+std::uint64_t checksum(void const * data, std::size_t size)
+{
+    const std::uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+
+    std::uint64_t h = size * m;
+
+    unsigned char const * bytes = static_cast<unsigned char const *>(data);
+    unsigned char const * end = bytes + (size & ~std::size_t(7));
+
+    for (; bytes != end; bytes += 8)
+    {
+        std::uint64_t k;
+        std::memcpy(&k, bytes, sizeof(k));
+
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+
+        h ^= k;
+        h *= m;
+    }
+
+    switch (size & 7)
+    {
+        case 7: h ^= std::uint64_t(bytes[6]) << 48;
+        // fall through
+        case 6: h ^= std::uint64_t(bytes[5]) << 40;
+        // fall through
+        case 5: h ^= std::uint64_t(bytes[4]) << 32;
+        // fall through
+        case 4: h ^= std::uint64_t(bytes[3]) << 24;
+        // fall through
+        case 3: h ^= std::uint64_t(bytes[2]) << 16;
+        // fall through
+        case 2: h ^= std::uint64_t(bytes[1]) << 8;
+        // fall through
+        case 1: h ^= std::uint64_t(bytes[0]);
+                h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+
+    return h;
+}
+
+}
@@ -0,0 +1,212 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#ifndef MAPNIK_RENDER_SINK_HPP
+#define MAPNIK_RENDER_SINK_HPP
+
+#include <string>
+#include <map>
+#include <list>
+#include <limits>
+#include <mutex>
+#include <memory>
+#include <cstdint>
+#include <utility>
+#include <chrono>
+#include <type_traits>
+
+#include <mapnik/util/variant.hpp>
+
+#include <boost/filesystem.hpp>
+#include <boost/optional.hpp>
+
+#include "config.hpp"
+#include "spool.hpp"
+#include "trace.hpp"
+
+namespace mapnik_render
+{
+
+// Writes encoded images to result's image path.
+struct file_sink
+{
+    static constexpr const char * name = "file";
+
+    void write(std::string const & data, result & res) const;
+    void write(spooled_output const & output, result & res) const;
+};
+
+// Discards images without encoding them.
+struct null_sink
+{
+    static constexpr const char * name = "null";
+};
+
+// Keeps encoded images in memory, keyed by result's image path, until they
+// are taken. When stored images exceed capacity bytes, the oldest ones are
+// dropped. Copies share storage.
+class memory_sink
+{
+public:
+    static constexpr const char * name = "memory";
+
+    explicit memory_sink(std::size_t capacity = std::numeric_limits<std::size_t>::max());
+
+    void write(std::string data, result & res) const;
+    void write(spooled_output const & output, result & res) const;
+    // Removes image from memory and returns it.
+    boost::optional<std::string> take(boost::filesystem::path const & path) const;
+
+private:
+    struct image
+    {
+        std::string data;
+        std::list<std::string>::iterator position;
+    };
+
+    struct storage
+    {
+        explicit storage(std::size_t _capacity) : capacity(_capacity), bytes(0) { }
+
+        mutable std::mutex mutex;
+        const std::size_t capacity;
+        std::size_t bytes;
+        // Paths from oldest to newest.
+        std::list<std::string> order;
+        std::map<std::string, image> images;
+
+        // Removes image and returns its data.
+        std::string erase(std::map<std::string, image>::iterator it);
+    };
+
+    std::shared_ptr<storage> storage_;
+};
+
+// Stores only hash of raw pixels or bytes in result.
+struct checksum_sink
+{
+    static constexpr const char * name = "checksum";
+
+    void write(void const * data, std::size_t size, result & res) const;
+    void write(spooled_output const & output, result & res) const;
+};
+
+using sink_type = mapnik::util::variant<file_sink, null_sink, memory_sink, checksum_sink>;
+
+// Memory sink keeps at most memory_capacity bytes.
+sink_type create_sink(std::string const & name, std::size_t memory_capacity);
+
+// MurmurHash64A, reads eight bytes at a time.
+std::uint64_t checksum(void const * data, std::size_t size);
+
+// Encodes image only for sinks which need encoded data. Renderer provides
+// encode() and raw() for its image type. Spooled output is already encoded
+// and goes to sinks as is, so does output encoded earlier for comparison.
+template <typename Renderer>
+class save_visitor
+{
+public:
+    using image_type = typename Renderer::image_type;
+
+    save_visitor(Renderer const & renderer, image_type const & image, result & res,
+                 std::string const * encoded = nullptr)
+        : renderer_(renderer), image_(image), result_(res), encoded_(encoded)
+    {
+    }
+
+    void operator()(file_sink const & sink) const
+    {
+        write(sink, spooled());
+    }
+
+    void operator()(null_sink const &) const
+    {
+    }
+
+    void operator()(memory_sink const & sink) const
+    {
+        write(sink, spooled());
+    }
+
+    void operator()(checksum_sink const & sink) const
+    {
+        trace_span span("encode");
+        std::chrono::high_resolution_clock::time_point start(std::chrono::high_resolution_clock::now());
+        write_raw(sink, spooled());
+        result_.phases.encode += std::chrono::high_resolution_clock::now() - start;
+    }
+
+private:
+    using spooled = std::is_same<image_type, spooled_output>;
+
+    template <typename Sink>
+    void write(Sink const & sink, std::true_type) const
+    {
+        sink.write(image_, result_);
+    }
+
+    template <typename Sink>
+    void write(Sink const & sink, std::false_type) const
+    {
+        if (encoded_)
+        {
+            sink.write(*encoded_, result_);
+        }
+        else
+        {
+            sink.write(encode(), result_);
+        }
+    }
+
+    void write_raw(checksum_sink const & sink, std::true_type) const
+    {
+        sink.write(image_, result_);
+    }
+
+    void write_raw(checksum_sink const & sink, std::false_type) const
+    {
+        std::pair<void const *, std::size_t> raw(renderer_.raw(image_));
+        sink.write(raw.first, raw.second, result_);
+    }
+
+    // Vector renderers return their data as is, without a copy.
+    using encoded_type = decltype(std::declval<Renderer const &>().encode(std::declval<image_type const &>()));
+
+    encoded_type encode() const
+    {
+        trace_span span("encode");
+        std::chrono::high_resolution_clock::time_point start(std::chrono::high_resolution_clock::now());
+        encoded_type data(renderer_.encode(image_));
+        result_.phases.encode += std::chrono::high_resolution_clock::now() - start;
+        return data;
+    }
+
+    Renderer const & renderer_;
+    image_type const & image_;
+    result & result_;
+    std::string const * encoded_;
+};
+
+}
+
+#endif
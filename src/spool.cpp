@@ -0,0 +1,371 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#include <stdexcept>
+#include <algorithm>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "spool.hpp"
+#include "sink.hpp"
+
+namespace mapnik_render
+{
+
+constexpr const std::size_t spooled_output::buffer_size;
+constexpr const std::size_t spool_streambuf::buffer_size;
+
+namespace {
+
+// Closes descriptor when leaving scope.
+struct file_descriptor
+{
+    explicit file_descriptor(int _fd) : fd(_fd) { }
+    ~file_descriptor() { if (fd >= 0) ::close(fd); }
+    file_descriptor(file_descriptor const &) = delete;
+    file_descriptor & operator=(file_descriptor const &) = delete;
+    const int fd;
+};
+
+int open_for_reading(boost::filesystem::path const & path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Could not open file: " + path.string() + ": " + std::strerror(errno));
+    }
+    return fd;
+}
+
+// Reads until buffer is full or end of file is reached.
+std::size_t read_full(int fd, char * buffer, std::size_t size)
+{
+    std::size_t total = 0;
+    while (total < size)
+    {
+        ssize_t count = ::read(fd, buffer + total, size - total);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count < 0)
+        {
+            throw std::runtime_error(std::string("Read error: ") + std::strerror(errno));
+        }
+        if (count == 0)
+        {
+            break;
+        }
+        total += count;
+    }
+    return total;
+}
+
+// umask can only be read by setting it, which is not thread safe. Read it
+// once during static initialization, before any thread is started.
+mode_t read_umask()
+{
+    mode_t mask = ::umask(0);
+    ::umask(mask);
+    return mask;
+}
+
+const mode_t process_umask = read_umask();
+
+}
+
+spooled_output::spooled_output()
+    : fd_(-1), used_(0), size_(0), failed_(false), committed_(false)
+{
+}
+
+spooled_output::spooled_output(boost::filesystem::path const & directory)
+    : fd_(-1), buffer_(new char[buffer_size]), used_(0), size_(0), failed_(false), committed_(false)
+{
+    boost::filesystem::create_directories(directory);
+    std::string name((directory / ".spool-XXXXXX").string());
+    fd_ = ::mkstemp(&name[0]);
+    if (fd_ < 0)
+    {
+        throw std::runtime_error("Could not create temporary file in " + directory.string() + ": " + std::strerror(errno));
+    }
+    path_ = name;
+}
+
+spooled_output::spooled_output(spooled_output && other)
+    : fd_(other.fd_),
+      path_(std::move(other.path_)),
+      buffer_(std::move(other.buffer_)),
+      used_(other.used_),
+      size_(other.size_),
+      failed_(other.failed_),
+      committed_(other.committed_)
+{
+    other.fd_ = -1;
+    other.path_.clear();
+}
+
+spooled_output & spooled_output::operator=(spooled_output && other)
+{
+    if (this != &other)
+    {
+        remove();
+        fd_ = other.fd_;
+        path_ = std::move(other.path_);
+        buffer_ = std::move(other.buffer_);
+        used_ = other.used_;
+        size_ = other.size_;
+        failed_ = other.failed_;
+        committed_ = other.committed_;
+        other.fd_ = -1;
+        other.path_.clear();
+    }
+    return *this;
+}
+
+spooled_output::~spooled_output()
+{
+    remove();
+}
+
+void spooled_output::remove()
+{
+    if (fd_ >= 0)
+    {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    if (!path_.empty() && !committed_)
+    {
+        ::unlink(path_.c_str());
+    }
+}
+
+bool spooled_output::write(void const * data, std::size_t size)
+{
+    size_ += size;
+    if (discarded())
+    {
+        return true;
+    }
+    if (fd_ < 0 || failed_)
+    {
+        return false;
+    }
+    if (used_ + size > buffer_size)
+    {
+        if (!flush())
+        {
+            return false;
+        }
+    }
+    if (size >= buffer_size)
+    {
+        // Large chunks bypass the buffer.
+        char const * bytes = static_cast<char const *>(data);
+        while (size > 0)
+        {
+            ssize_t count = ::write(fd_, bytes, size);
+            if (count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (count < 0)
+            {
+                failed_ = true;
+                return false;
+            }
+            bytes += count;
+            size -= count;
+        }
+        return true;
+    }
+    std::memcpy(buffer_.get() + used_, data, size);
+    used_ += size;
+    return true;
+}
+
+bool spooled_output::flush()
+{
+    std::size_t offset = 0;
+    while (offset < used_)
+    {
+        ssize_t count = ::write(fd_, buffer_.get() + offset, used_ - offset);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count < 0)
+        {
+            failed_ = true;
+            return false;
+        }
+        offset += count;
+    }
+    used_ = 0;
+    return true;
+}
+
+void spooled_output::close()
+{
+    if (fd_ < 0)
+    {
+        return;
+    }
+    bool flushed = !failed_ && flush();
+    int error = ::close(fd_);
+    fd_ = -1;
+    buffer_.reset();
+    if (!flushed || error != 0)
+    {
+        throw std::runtime_error("Could not write temporary file: " + path_.string());
+    }
+}
+
+void spooled_output::commit(boost::filesystem::path const & destination) const
+{
+    if (discarded() || committed_)
+    {
+        throw std::runtime_error("No output to write to " + destination.string());
+    }
+    if (destination.has_parent_path())
+    {
+        boost::filesystem::create_directories(destination.parent_path());
+    }
+    // mkstemp creates private files, give them the mode of an ordinary file.
+    if (::chmod(path_.c_str(), 0666 & ~process_umask) != 0)
+    {
+        throw std::runtime_error("Could not set permissions of " + path_.string() + ": " + std::strerror(errno));
+    }
+    boost::system::error_code ec;
+    boost::filesystem::rename(path_, destination, ec);
+    if (ec)
+    {
+        // Different file system, fall back to copying.
+        boost::filesystem::copy_file(path_, destination, boost::filesystem::copy_option::overwrite_if_exists);
+        ::unlink(path_.c_str());
+    }
+    committed_ = true;
+}
+
+std::string spooled_output::read() const
+{
+    if (discarded())
+    {
+        return std::string();
+    }
+    file_descriptor file(open_for_reading(path_));
+    std::string data(size_, '\0');
+    data.resize(read_full(file.fd, &data[0], data.size()));
+    return data;
+}
+
+std::uint64_t spooled_output::checksum() const
+{
+    if (discarded() || size_ == 0)
+    {
+        return mapnik_render::checksum(nullptr, 0);
+    }
+    file_descriptor file(open_for_reading(path_));
+    void * data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, file.fd, 0);
+    if (data == MAP_FAILED)
+    {
+        throw std::runtime_error("Could not map file: " + path_.string());
+    }
+    ::madvise(data, size_, MADV_SEQUENTIAL);
+    std::uint64_t hash = mapnik_render::checksum(data, size_);
+    ::munmap(data, size_);
+    return hash;
+}
+
+std::size_t spooled_output::compare(boost::filesystem::path const & reference) const
+{
+    const std::size_t chunk = 1 << 16;
+    file_descriptor expected(open_for_reading(reference));
+    file_descriptor actual(open_for_reading(path_));
+    std::vector<char> expected_buffer(chunk), actual_buffer(chunk);
+    std::size_t different = 0;
+    for (;;)
+    {
+        std::size_t expected_size = read_full(expected.fd, expected_buffer.data(), chunk);
+        std::size_t actual_size = read_full(actual.fd, actual_buffer.data(), chunk);
+        std::size_t common = std::min(expected_size, actual_size);
+        for (std::size_t i = 0; i < common; i++)
+        {
+            different += expected_buffer[i] != actual_buffer[i];
+        }
+        if (expected_size < chunk || actual_size < chunk)
+        {
+            // Rest of the longer file is counted as different.
+            different += std::max(expected_size, actual_size) - common;
+            char * rest = expected_size < chunk ? actual_buffer.data() : expected_buffer.data();
+            int fd = expected_size < chunk ? actual.fd : expected.fd;
+            std::size_t count;
+            while ((count = read_full(fd, rest, chunk)) > 0)
+            {
+                different += count;
+            }
+            return different;
+        }
+    }
+}
+
+spool_streambuf::spool_streambuf(spooled_output & output)
+    : output_(output), buffer_(buffer_size)
+{
+    setp(buffer_.data(), buffer_.data() + buffer_.size());
+}
+
+spool_streambuf::int_type spool_streambuf::overflow(int_type c)
+{
+    if (!flush())
+    {
+        return traits_type::eof();
+    }
+    if (!traits_type::eq_int_type(c, traits_type::eof()))
+    {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+int spool_streambuf::sync()
+{
+    return flush() ? 0 : -1;
+}
+
+bool spool_streambuf::flush()
+{
+    bool written = output_.write(pbase(), pptr() - pbase());
+    setp(buffer_.data(), buffer_.data() + buffer_.size());
+    return written;
+}
+
+}
@@ -0,0 +1,106 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#ifndef MAPNIK_RENDER_SPOOL_HPP
+#define MAPNIK_RENDER_SPOOL_HPP
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <streambuf>
+
+#include <boost/filesystem.hpp>
+
+namespace mapnik_render
+{
+
+// Output of a streaming renderer. Bytes go through a fixed buffer straight to
+// a temporary file in the output directory, so memory use does not grow with
+// size of the output. The file is renamed to its destination on commit and
+// removed otherwise. Default constructed output counts bytes and discards them.
+class spooled_output
+{
+public:
+    static constexpr const std::size_t buffer_size = 1 << 20;
+
+    spooled_output();
+    explicit spooled_output(boost::filesystem::path const & directory);
+    spooled_output(spooled_output && other);
+    spooled_output & operator=(spooled_output && other);
+    ~spooled_output();
+
+    bool write(void const * data, std::size_t size);
+
+    // Flushes buffer and closes the file, must be called before output is read.
+    void close();
+
+    std::size_t size() const { return size_; }
+    bool discarded() const { return path_.empty(); }
+
+    // Moves the file to destination, once. Destination directories are created.
+    void commit(boost::filesystem::path const & destination) const;
+
+    std::string read() const;
+    std::uint64_t checksum() const;
+
+    // Number of bytes differing from reference file, missing or extra bytes included.
+    std::size_t compare(boost::filesystem::path const & reference) const;
+
+private:
+    bool flush();
+    void remove();
+
+    int fd_;
+    boost::filesystem::path path_;
+    std::unique_ptr<char[]> buffer_;
+    std::size_t used_;
+    std::size_t size_;
+    bool failed_;
+    // Commit leaves const output without a file, there is nothing to remove then.
+    mutable bool committed_;
+};
+
+// Stream buffer writing to spooled output in blocks, for writers which need
+// an std::ostream. Call pubsync() and check the stream before closing output.
+class spool_streambuf : public std::streambuf
+{
+public:
+    static constexpr const std::size_t buffer_size = 1 << 16;
+
+    explicit spool_streambuf(spooled_output & output);
+
+protected:
+    int_type overflow(int_type c) override;
+    int sync() override;
+
+private:
+    bool flush();
+
+    spooled_output & output_;
+    std::vector<char> buffer_;
+};
+
+}
+
+#endif
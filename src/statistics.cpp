@@ -0,0 +1,153 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#include <algorithm>
+#include <cmath>
+
+#include "statistics.hpp"
+
+namespace mapnik_render
+{
+
+duration_type percentile(std::vector<duration_type> const & sorted_samples, double p)
+{
+    if (sorted_samples.empty())
+    {
+        return duration_type::zero();
+    }
+
+    double rank = p * (sorted_samples.size() - 1);
+    std::size_t lower = static_cast<std::size_t>(std::floor(rank));
+    std::size_t upper = std::min(lower + 1, sorted_samples.size() - 1);
+    double fraction = rank - lower;
+    double value = sorted_samples[lower].count() +
+        fraction * (sorted_samples[upper].count() - sorted_samples[lower].count());
+    return duration_type(static_cast<duration_type::rep>(std::llround(value)));
+}
+
+duration_statistics compute_statistics(std::vector<duration_type> const & samples)
+{
+    duration_statistics stats;
+
+    if (samples.empty())
+    {
+        return stats;
+    }
+
+    std::vector<duration_type> sorted(samples);
+    std::sort(sorted.begin(), sorted.end());
+
+    double sum = 0;
+    for (auto const & sample : sorted)
+    {
+        sum += sample.count();
+    }
+    double mean = sum / sorted.size();
+
+    double squares = 0;
+    for (auto const & sample : sorted)
+    {
+        double diff = sample.count() - mean;
+        squares += diff * diff;
+    }
+    double variance = sorted.size() > 1 ? squares / (sorted.size() - 1) : 0.0;
+
+    stats.min = sorted.front();
+    stats.max = sorted.back();
+    stats.median = percentile(sorted, 0.5);
+    stats.mean = duration_type(static_cast<duration_type::rep>(std::llround(mean)));
+    stats.p95 = percentile(sorted, 0.95);
+    stats.p99 = percentile(sorted, 0.99);
+    stats.stddev = duration_type(static_cast<duration_type::rep>(std::llround(std::sqrt(variance))));
+
+    return stats;
+}
+
+double mann_whitney_p(std::vector<duration_type> const & a, std::vector<duration_type> const & b)
+{
+    if (a.empty() || b.empty())
+    {
+        return 1.0;
+    }
+
+    // Rank pooled samples, tied values get mean of their ranks.
+    std::vector<std::pair<duration_type, bool>> pooled;
+    pooled.reserve(a.size() + b.size());
+    for (auto const & sample : a)
+    {
+        pooled.emplace_back(sample, true);
+    }
+    for (auto const & sample : b)
+    {
+        pooled.emplace_back(sample, false);
+    }
+    std::sort(pooled.begin(), pooled.end(),
+        [](std::pair<duration_type, bool> const & l, std::pair<duration_type, bool> const & r)
+        {
+            return l.first < r.first;
+        });
+
+    double rank_sum_a = 0;
+    double tie_term = 0;
+    for (std::size_t i = 0; i < pooled.size(); )
+    {
+        std::size_t j = i;
+        while (j < pooled.size() && pooled[j].first == pooled[i].first)
+        {
+            j++;
+        }
+        double rank = (i + 1 + j) / 2.0;
+        for (std::size_t k = i; k < j; k++)
+        {
+            if (pooled[k].second)
+            {
+                rank_sum_a += rank;
+            }
+        }
+        double t = j - i;
+        tie_term += t * t * t - t;
+        i = j;
+    }
+
+    double n1 = a.size();
+    double n2 = b.size();
+    double n = n1 + n2;
+    double u = rank_sum_a - n1 * (n1 + 1) / 2.0;
+    double mean = n1 * n2 / 2.0;
+    double variance = n1 * n2 / 12.0 * ((n + 1) - tie_term / (n * (n - 1)));
+
+    if (variance <= 0)
+    {
+        return 1.0;
+    }
+
+    double z = std::max(std::abs(u - mean) - 0.5, 0.0) / std::sqrt(variance);
+    return std::erfc(z / std::sqrt(2.0));
+}
+
+double to_milliseconds(duration_type const & d)
+{
+    return std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(d).count();
+}
+
+}
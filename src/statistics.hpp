@@ -0,0 +1,62 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#ifndef MAPNIK_RENDER_STATISTICS_HPP
+#define MAPNIK_RENDER_STATISTICS_HPP
+
+#include <vector>
+#include <chrono>
+
+namespace mapnik_render
+{
+
+using duration_type = std::chrono::high_resolution_clock::duration;
+
+struct duration_statistics
+{
+    duration_type min = duration_type::zero();
+    duration_type max = duration_type::zero();
+    duration_type median = duration_type::zero();
+    duration_type mean = duration_type::zero();
+    duration_type p95 = duration_type::zero();
+    duration_type p99 = duration_type::zero();
+    duration_type stddev = duration_type::zero();
+};
+
+duration_statistics compute_statistics(std::vector<duration_type> const & samples);
+
+// Percentile with linear interpolation between closest ranks, samples must be sorted.
+duration_type percentile(std::vector<duration_type> const & sorted_samples, double p);
+
+// Two-sided p-value of Mann-Whitney U test that samples a and b come from
+// the same distribution. Uses normal approximation with tie and continuity
+// correction, so a handful of samples on each side is needed to get small
+// values; returns 1 when either side is empty.
+double mann_whitney_p(std::vector<duration_type> const & a, std::vector<duration_type> const & b);
+
+// Converts duration to fractional milliseconds for reporting.
+double to_milliseconds(duration_type const & d);
+
+}
+
+#endif
@@ -0,0 +1,199 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#include "thread_pool.hpp"
+
+namespace mapnik_render
+{
+
+namespace
+{
+
+thread_local thread_pool const * current_pool = nullptr;
+thread_local std::size_t current_worker = 0;
+
+}
+
+thread_pool::thread_pool(std::size_t threads)
+    : queued_(0),
+      stop_(false),
+      next_queue_(0)
+{
+    if (threads == 0)
+    {
+        threads = 1;
+    }
+
+    for (std::size_t i = 0; i < threads; i++)
+    {
+        queues_.emplace_back(new task_queue());
+    }
+
+    for (std::size_t i = 0; i < threads; i++)
+    {
+        workers_.emplace_back(&thread_pool::work, this, i);
+    }
+}
+
+thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(idle_mutex_);
+        stop_ = true;
+    }
+    idle_.notify_all();
+
+    for (auto & worker : workers_)
+    {
+        worker.join();
+    }
+}
+
+void thread_pool::submit(task_type task)
+{
+    std::size_t index = (current_pool == this) ?
+        current_worker :
+        next_queue_++ % queues_.size();
+
+    {
+        task_queue & queue = *queues_[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(idle_mutex_);
+        queued_++;
+    }
+    idle_.notify_one();
+}
+
+bool thread_pool::pop(std::size_t index, task_type & task)
+{
+    bool found = false;
+
+    {
+        task_queue & own = *queues_[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty())
+        {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            found = true;
+        }
+    }
+
+    for (std::size_t i = 1; !found && i < queues_.size(); i++)
+    {
+        task_queue & victim = *queues_[(index + i) % queues_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            found = true;
+        }
+    }
+
+    if (found)
+    {
+        std::lock_guard<std::mutex> lock(idle_mutex_);
+        queued_--;
+    }
+
+    return found;
+}
+
+void thread_pool::work(std::size_t index)
+{
+    current_pool = this;
+    current_worker = index;
+
+    task_type task;
+    while (true)
+    {
+        if (pop(index, task))
+        {
+            task(index);
+            task = nullptr;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(idle_mutex_);
+        idle_.wait(lock, [this] { return queued_ > 0 || stop_; });
+        if (stop_ && queued_ == 0)
+        {
+            return;
+        }
+    }
+}
+
+task_group::task_group(thread_pool & pool)
+    : pool_(pool),
+      pending_(0)
+{
+}
+
+void task_group::run(thread_pool::task_type task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_++;
+    }
+
+    pool_.submit([this, task](std::size_t worker)
+    {
+        try
+        {
+            task(worker);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!error_)
+            {
+                error_ = std::current_exception();
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--pending_ == 0)
+        {
+            done_.notify_all();
+        }
+    });
+}
+
+void task_group::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return pending_ == 0; });
+    if (error_)
+    {
+        std::exception_ptr error(error_);
+        error_ = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+}
@@ -0,0 +1,107 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#ifndef MAPNIK_RENDER_THREAD_POOL_HPP
+#define MAPNIK_RENDER_THREAD_POOL_HPP
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <memory>
+#include <atomic>
+
+namespace mapnik_render
+{
+
+// Work-stealing pool. Every worker owns a queue; tasks submitted from
+// a worker go to the back of its own queue and are taken LIFO by the
+// owner, idle workers steal FIFO from the front of other queues.
+class thread_pool
+{
+public:
+    // Tasks receive index of the worker executing them, so callers can
+    // keep per-worker state without locking.
+    using task_type = std::function<void(std::size_t)>;
+
+    explicit thread_pool(std::size_t threads);
+    ~thread_pool();
+
+    thread_pool(thread_pool const &) = delete;
+    thread_pool & operator=(thread_pool const &) = delete;
+
+    void submit(task_type task);
+
+    std::size_t size() const
+    {
+        return workers_.size();
+    }
+
+private:
+    struct task_queue
+    {
+        std::mutex mutex;
+        std::deque<task_type> tasks;
+    };
+
+    void work(std::size_t index);
+    bool pop(std::size_t index, task_type & task);
+
+    std::vector<std::unique_ptr<task_queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::mutex idle_mutex_;
+    std::condition_variable idle_;
+    std::size_t queued_;
+    bool stop_;
+    std::atomic<std::size_t> next_queue_;
+};
+
+// Tracks a set of tasks submitted to a pool, tasks may add further tasks
+// to the same group. wait() must not be called from a worker of the pool.
+class task_group
+{
+public:
+    explicit task_group(thread_pool & pool);
+
+    task_group(task_group const &) = delete;
+    task_group & operator=(task_group const &) = delete;
+
+    void run(thread_pool::task_type task);
+
+    // Blocks until all tasks are done, rethrows first exception thrown by a task.
+    void wait();
+
+private:
+    thread_pool & pool_;
+    std::mutex mutex_;
+    std::condition_variable done_;
+    std::size_t pending_;
+    std::exception_ptr error_;
+};
+
+}
+
+#endif
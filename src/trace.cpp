@@ -0,0 +1,133 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+
+#include <unistd.h>
+
+#include "trace.hpp"
+#include "report.hpp"
+
+namespace mapnik_render
+{
+
+namespace
+{
+
+thread_local std::shared_ptr<trace_context const> current_context;
+
+std::atomic<unsigned> thread_count { 0 };
+
+double microseconds(trace_log::clock::duration d)
+{
+    return std::chrono::duration<double, std::micro>(d).count();
+}
+
+}
+
+trace_log::trace_log()
+    : origin_(clock::now())
+{
+}
+
+unsigned trace_log::thread_number()
+{
+    thread_local unsigned number = ++thread_count;
+    return number;
+}
+
+void trace_log::add(char const * name,
+                    std::string const & style,
+                    std::string const & renderer,
+                    clock::time_point start,
+                    clock::time_point end)
+{
+    unsigned thread = thread_number();
+    std::lock_guard<std::mutex> lock(mutex_);
+    events_.push_back(event { name, style, renderer, start - origin_, end - start, thread });
+}
+
+void trace_log::write(std::string const & file) const
+{
+    std::ofstream o(file.c_str(), std::ios::out | std::ios::trunc);
+    if (!o)
+    {
+        throw std::runtime_error("Cannot open trace file: " + file);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    const int pid = ::getpid();
+    o << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    for (std::size_t i = 0; i < events_.size(); i++)
+    {
+        event const & e = events_[i];
+        o << (i ? ",\n" : "\n")
+          << "{\"name\": \"" << e.name << "\", \"cat\": \"phase\", \"ph\": \"X\""
+          << ", \"ts\": " << std::fixed << std::setprecision(3) << microseconds(e.start)
+          << ", \"dur\": " << microseconds(e.duration)
+          << ", \"pid\": " << pid << ", \"tid\": " << e.thread
+          << ", \"args\": {\"style\": " << json_string(e.style)
+          << ", \"renderer\": " << json_string(e.renderer) << "}}";
+    }
+    o << "\n]}" << std::endl;
+
+    if (!o)
+    {
+        throw std::runtime_error("Cannot write trace file: " + file);
+    }
+}
+
+trace_scope::trace_scope(std::shared_ptr<trace_context const> const & context)
+    : previous_(std::move(current_context))
+{
+    current_context = context;
+}
+
+trace_scope::~trace_scope()
+{
+    current_context = std::move(previous_);
+}
+
+std::shared_ptr<trace_context const> trace_scope::current()
+{
+    return current_context;
+}
+
+trace_span::trace_span(char const * name)
+    : context_(current_context.get()),
+      name_(name),
+      start_(context_ ? trace_log::clock::now() : trace_log::clock::time_point())
+{
+}
+
+trace_span::~trace_span()
+{
+    if (context_)
+    {
+        context_->log.add(name_, context_->style, context_->renderer, start_, trace_log::clock::now());
+    }
+}
+
+}
@@ -0,0 +1,118 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#ifndef MAPNIK_RENDER_TRACE_HPP
+#define MAPNIK_RENDER_TRACE_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+namespace mapnik_render
+{
+
+// Timeline of phases of all threads, written in Chrome trace event format
+// readable by chrome://tracing and Perfetto.
+class trace_log
+{
+public:
+    using clock = std::chrono::high_resolution_clock;
+
+    trace_log();
+
+    void add(char const * name,
+             std::string const & style,
+             std::string const & renderer,
+             clock::time_point start,
+             clock::time_point end);
+
+    void write(std::string const & file) const;
+
+private:
+    struct event
+    {
+        char const * name;
+        std::string style;
+        std::string renderer;
+        clock::duration start;
+        clock::duration duration;
+        unsigned thread;
+    };
+
+    // Small sequential number of calling thread, stable for its lifetime.
+    static unsigned thread_number();
+
+    const clock::time_point origin_;
+    mutable std::mutex mutex_;
+    std::vector<event> events_;
+};
+
+// Log and names spans of the current job are recorded with.
+struct trace_context
+{
+    trace_log & log;
+    const std::string style;
+    const std::string renderer;
+};
+
+// Makes context current for spans on this thread while in scope. Tasks
+// running on behalf of a job on other threads open their own scope with
+// the context of the submitting thread. Null context disables tracing.
+class trace_scope
+{
+public:
+    explicit trace_scope(std::shared_ptr<trace_context const> const & context);
+    ~trace_scope();
+
+    trace_scope(trace_scope const &) = delete;
+    trace_scope & operator=(trace_scope const &) = delete;
+
+    static std::shared_ptr<trace_context const> current();
+
+private:
+    std::shared_ptr<trace_context const> previous_;
+};
+
+// Records time from construction to destruction as phase of current
+// context, if there is one.
+class trace_span
+{
+public:
+    explicit trace_span(char const * name);
+    ~trace_span();
+
+    trace_span(trace_span const &) = delete;
+    trace_span & operator=(trace_span const &) = delete;
+
+private:
+    trace_context const * context_;
+    char const * name_;
+    trace_log::clock::time_point start_;
+};
+
+}
+
+#endif
@@ -0,0 +1,229 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#if defined(GRID_RENDERER)
+
+#include <unordered_map>
+#include <iomanip>
+#include <sstream>
+
+#include <mapnik/feature.hpp>
+
+#include "utfgrid.hpp"
+
+namespace mapnik_render
+{
+
+namespace
+{
+
+// Code point of n-th key, skipping characters JSON strings would need to
+// escape and UTF-16 surrogates, which cannot be encoded in UTF-8.
+std::uint32_t code_point(std::size_t index)
+{
+    std::uint32_t c = static_cast<std::uint32_t>(index) + 32;
+    if (c >= 34)
+    {
+        c++;
+    }
+    if (c >= 92)
+    {
+        c++;
+    }
+    if (c >= 0xd800)
+    {
+        c += 0x800;
+    }
+    return c;
+}
+
+void append_utf8(std::string & out, std::uint32_t c)
+{
+    if (c < 0x80)
+    {
+        out += static_cast<char>(c);
+    }
+    else if (c < 0x800)
+    {
+        out += static_cast<char>(0xc0 | (c >> 6));
+        out += static_cast<char>(0x80 | (c & 0x3f));
+    }
+    else if (c < 0x10000)
+    {
+        out += static_cast<char>(0xe0 | (c >> 12));
+        out += static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (c & 0x3f));
+    }
+    else
+    {
+        out += static_cast<char>(0xf0 | (c >> 18));
+        out += static_cast<char>(0x80 | ((c >> 12) & 0x3f));
+        out += static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (c & 0x3f));
+    }
+}
+
+void append_json_string(std::string & out, std::string const & str)
+{
+    out += '"';
+    for (char c : str)
+    {
+        switch (c)
+        {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20)
+                {
+                    std::ostringstream escaped;
+                    escaped << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c);
+                    out += escaped.str();
+                }
+                else
+                {
+                    out += c;
+                }
+        }
+    }
+    out += '"';
+}
+
+}
+
+std::string encode_utfgrid(mapnik::grid const & grid,
+                           unsigned resolution,
+                           std::vector<std::string> const & fields)
+{
+    using value_type = mapnik::grid::value_type;
+
+    if (resolution == 0)
+    {
+        resolution = 1;
+    }
+
+    mapnik::grid::data_type const & data = grid.data();
+    mapnik::grid::feature_key_type const & feature_keys = grid.get_feature_keys();
+    std::size_t width = (data.width() + resolution - 1) / resolution;
+    std::size_t height = (data.height() + resolution - 1) / resolution;
+
+    // Ids map to keys, distinct ids may share a key and so a character.
+    std::unordered_map<value_type, std::size_t> indexes;
+    std::unordered_map<std::string, std::size_t> key_indexes;
+    std::vector<std::string> keys;
+    std::vector<std::string> characters;
+
+    std::string out;
+    out.reserve(height * (width + 4) + 64);
+    out += "{\"grid\":[";
+
+    for (std::size_t y = 0; y < height; ++y)
+    {
+        value_type const * row = data.get_row(y * resolution);
+        out += y ? ",\"" : "\"";
+
+        // Neighbouring pixels mostly belong to the same feature.
+        value_type last_id = 0;
+        std::string const * last = nullptr;
+        for (std::size_t x = 0; x < width; ++x)
+        {
+            value_type id = row[x * resolution];
+            if (!last || id != last_id)
+            {
+                auto index = indexes.find(id);
+                if (index == indexes.end())
+                {
+                    std::string key;
+                    if (id != mapnik::grid::base_mask)
+                    {
+                        auto feature_key = feature_keys.find(id);
+                        key = feature_key != feature_keys.end() ? feature_key->second : std::to_string(id);
+                    }
+                    auto inserted = key_indexes.emplace(key, keys.size());
+                    if (inserted.second)
+                    {
+                        keys.push_back(key);
+                        characters.emplace_back();
+                        append_utf8(characters.back(), code_point(inserted.first->second));
+                    }
+                    index = indexes.emplace(id, inserted.first->second).first;
+                }
+                last_id = id;
+                last = &characters[index->second];
+            }
+            out += *last;
+        }
+        out += '"';
+    }
+
+    out += "],\"keys\":[";
+    for (std::size_t i = 0; i < keys.size(); ++i)
+    {
+        if (i)
+        {
+            out += ',';
+        }
+        append_json_string(out, keys[i]);
+    }
+
+    out += "],\"data\":{";
+    if (!fields.empty())
+    {
+        mapnik::grid::feature_type const & features = grid.get_grid_features();
+        bool first = true;
+        for (std::string const & key : keys)
+        {
+            auto feature = features.find(key);
+            if (feature == features.end() || !feature->second)
+            {
+                continue;
+            }
+            out += first ? "" : ",";
+            first = false;
+            append_json_string(out, key);
+            out += ":{";
+            bool first_field = true;
+            for (auto const & field : fields)
+            {
+                if (!feature->second->has_key(field))
+                {
+                    continue;
+                }
+                out += first_field ? "" : ",";
+                first_field = false;
+                append_json_string(out, field);
+                out += ':';
+                append_json_string(out, feature->second->get(field).to_string());
+            }
+            out += '}';
+        }
+    }
+    out += "}}";
+
+    return out;
+}
+
+}
+
+#endif
@@ -0,0 +1,49 @@
+/*****************************************************************************
+ *
+ * This file is part of Mapnik (c++ mapping toolkit)
+ *
+ * Copyright (C) 2015 Artem Pavlenko
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+
+#ifndef MAPNIK_RENDER_UTFGRID_HPP
+#define MAPNIK_RENDER_UTFGRID_HPP
+
+#if defined(GRID_RENDERER)
+
+#include <string>
+#include <vector>
+
+#include <mapnik/grid/grid.hpp>
+
+namespace mapnik_render
+{
+
+// Encodes grid as UTFGrid JSON. Every resolution-th pixel of every
+// resolution-th row is sampled, each distinct feature key gets one
+// character of the grid strings, skipping '"' and '\'. Attributes listed
+// in fields are written to data for every key present.
+std::string encode_utfgrid(mapnik::grid const & grid,
+                           unsigned resolution,
+                           std::vector<std::string> const & fields);
+
+}
+
+#endif
+
+#endif